@@ -15,10 +15,17 @@
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "ftimer.h"
 #include "config.h"
 
 /**********************
@@ -29,9 +36,14 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define MAXJOBS       64 /* max number of threads for -j */
+#define SHORT_LIFETIME 100 /* blocks freed within this many ops are short-lived */
 
-/* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((size_t)(p)) % ALIGNMENT) == 0)
+/* Returns true if p is align-byte aligned */
+#define IS_ALIGNED(p, align)  ((((size_t)(p)) % (align)) == 0)
+
+/* libc's posix_memalign wants at least pointer alignment */
+#define LIBC_ALIGN(align) ((align) < (int)sizeof(void *) ? (int)sizeof(void *) : (align))
 
 /****************************** 
  * The key compound data types 
@@ -39,16 +51,32 @@
 
 /* Records the extent of each block's payload */
 typedef struct range_t {
-    char *lo;              /* low payload address */
-    char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    char *lo;                /* low payload address */
+    char *hi;                /* high payload address */
+    size_t prio;             /* treap priority, a hash of lo */
+    struct range_t *left;    /* ranges below this one */
+    struct range_t *right;   /* ranges above this one */
+    struct range_t *parent;
 } range_t;
 
+/* The live payloads of a trace: a treap ordered by lo, to find the
+   neighbours of a new payload, and a hash from lo to its range, to find
+   the range of a freed one */
+typedef struct {
+    range_t *root;
+    range_t **slots;  /* open addressing, linear probing */
+    size_t nslots;    /* a power of 2, at least twice count */
+    size_t count;
+} ranges_t;
+
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
+    enum {ALLOC, FREE, REALLOC, ALLOC_BATCH, FREE_BATCH, MEMALIGN, CALLOC} type; /* type of request */
     int index;                        /* index for free() to use later */
     int size;                         /* byte size of alloc/realloc request */
+    int count;                        /* ids index..index+count-1 for a batch */
+    int align;                        /* alignment of a memalign request */
+    int hint;                         /* lifetime hint for an alloc (set by -L) */
 } traceop_t;
 
 /* Holds the information for one trace file*/
@@ -60,8 +88,27 @@ typedef struct {
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    void *map;           /* a binary trace file mapped whole, ops points into it */
+    size_t map_size;     /* (NULL and 0 for a text trace) */
 } trace_t;
 
+/*
+ * Header of a binary trace file, which -w writes. The num_ops traceop_t
+ * records follow it as they are laid out in memory, so that read_trace
+ * can map the file and replay it in place. A file written by a build
+ * with a different traceop_t has a different op_size and is refused.
+ */
+#define TRACE_MAGIC "MDTRACE\n"
+typedef struct {
+    char magic[8];       /* TRACE_MAGIC */
+    int sugg_heapsize;
+    int num_ids;
+    int num_ops;
+    int weight;
+    int op_size;         /* sizeof(traceop_t) */
+    int unused;          /* pads the records to 8 bytes */
+} tracehdr_t;
+
 /* 
  * Holds the params to the xxx_speed functions, which are timed by fcyc. 
  * This struct is necessary because fcyc accepts only a pointer array
@@ -69,9 +116,81 @@ typedef struct {
  */
 typedef struct {
     trace_t *trace;  
-    range_t *ranges;
+    ranges_t *ranges;
+    int jobs;                 /* number of threads for eval_mm_mt_speed */
+    char **blocks[MAXJOBS];   /* private copy of trace->blocks per thread */
+    struct part_t *part;      /* how the trace is split among them, or NULL */
+    double thread_secs[MAXJOBS]; /* fastest run of each thread */
 } speed_t;
 
+/*
+ * How a partitioned replay (-p) splits a trace among its threads. An op
+ * on an id waits until every earlier op on that id is done, whichever
+ * thread ran it.
+ */
+typedef struct part_t {
+    int jobs;
+    int *ops[MAXJOBS];   /* the ops each thread replays, in trace order */
+    int nops[MAXJOBS];
+    int *first;          /* where the ids of each op start in expect */
+    int *expect;         /* per id an op touches, the earlier ops on that id */
+    int *done;           /* ops done so far on each id */
+} part_t;
+
+/* Input to one thread of eval_mm_mt_speed */
+typedef struct {
+    trace_t *trace;
+    char **blocks;  /* this thread's array of ptrs returned by malloc/realloc */
+    part_t *part;   /* the split of the trace, or NULL to replay all of it */
+    int thread;     /* which share of the split is this thread's */
+    pthread_barrier_t *start; /* lets every thread go at once */
+    double secs;    /* how long this thread took */
+} replay_t;
+
+/* Number of ids an op touches */
+#define OP_IDS(op) (((op)->type == ALLOC_BATCH || (op)->type == FREE_BATCH) ? (op)->count : 1)
+
+/* Ops read ahead by the reader thread of a streamed replay (-s) */
+#define STREAM_CHUNK (1 << 16)   /* ops per buffer */
+typedef struct {
+    FILE *tracefile;
+    char *path;
+    int binary;               /* is it a binary trace file? */
+    int num_ids;              /* from the header */
+    int num_ops;
+    long read;                /* ops read so far */
+    traceop_t *bufs[2];       /* filled in turn by the reader */
+    int lens[2];              /* ops in each buffer, 0 at the end of the trace */
+    int full[2];              /* set by the reader, cleared by the replay */
+    pthread_mutex_t lock;     /* protects lens and full */
+    pthread_cond_t cond;
+} stream_t;
+
+/* A block live in a streamed replay, and the hash that finds it by id */
+typedef struct {
+    char *p;                  /* NULL for an empty slot */
+    int id;
+    int size;
+} live_t;
+
+typedef struct {
+    live_t *slots;            /* open addressing, linear probing */
+    size_t nslots;            /* a power of 2, at least twice count */
+    size_t count;
+} livemap_t;
+
+/* Input to stream_replay, and the totals it keeps across buffers */
+typedef struct {
+    traceop_t *ops;
+    int num_ops;
+    livemap_t *live;
+    void **batch;             /* pointers of one batch op */
+    int batch_size;
+    long total_size;          /* live payload bytes */
+    long max_total_size;
+    size_t max_live;          /* most blocks live at once */
+} chunk_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
@@ -81,6 +200,19 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    double mt_secs[MAXJOBS + 1];  /* secs for n threads to run the trace concurrently */
+    double thread_ops[MAXJOBS];   /* ops each of the -j threads ran... */
+    double thread_secs[MAXJOBS];  /* ...and the secs it took for them */
+
+    /* defined only with -L */
+    int blocks;            /* number of blocks the trace allocates */
+    int median_life;       /* median number of ops a block lives for */
+    double short_frac;     /* fraction of blocks that are short-lived */
+    double hint_util;      /* space utilization with lifetime hints */
+    double region_util[2]; /* the same per region, MM_HINT_NONE and MM_HINT_SHORT */
+
+    /* defined only with -v */
+    mm_stats_t heap;       /* mm_stats at the peak of the live payload */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
@@ -90,6 +222,8 @@ typedef struct {
  *******************/
 int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
+static size_t profile = 0; /* bytes between heap profiler samples (-P), 0 for none */
+static int check_level = MM_CHECK_OFF; /* mm_checkheap level after every op (-c) */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
 /* Directory where default tracefiles are found */
@@ -105,14 +239,21 @@ static char *default_tracefiles[] = {
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
-static int add_range(range_t **ranges, char *lo, int size, 
+/* these functions manipulate range sets */
+static int add_range(ranges_t *ranges, char *lo, int size, int align,
                      int tracenum, int opnum);
-static void remove_range(range_t **ranges, char *lo);
-static void clear_ranges(range_t **ranges);
+static void remove_range(ranges_t *ranges, char *lo);
+static void clear_ranges(ranges_t *ranges);
+static size_t range_hash(char *lo);
+static size_t range_slot(ranges_t *ranges, char *lo);
+static void range_rotate_up(ranges_t *ranges, range_t *p);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static int read_op(FILE *tracefile, traceop_t *op, char *path);
+static void map_trace(trace_t *trace, FILE *tracefile, tracehdr_t *hdr, char *path);
+static int op_ok(traceop_t *op, int num_ids);
+static void write_trace(trace_t *trace, char *filename);
 static void free_trace(trace_t *trace);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
@@ -121,15 +262,41 @@ static void eval_libc_speed(void *ptr);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
-static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
+static int eval_mm_valid(trace_t *trace, int tracenum, ranges_t *ranges);
+static double eval_mm_util(trace_t *trace, int tracenum, ranges_t *ranges,
+                           mm_stats_t *heap);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_mt_speed(void *ptr);
+static void mm_replay(void *ptr);
+static void mm_replay_part(void *ptr);
+static void *mm_replay_thread(void *ptr);
+static void eval_mm_mt(trace_t *trace, int jobs, int partition, stats_t *stats);
+static void partition_trace(trace_t *trace, int jobs, part_t *part);
+static void free_partition(part_t *part);
+static void eval_mm_edges(void);
+static void eval_mm_stream(char *filename);
+static void *stream_reader(void *ptr);
+static void stream_replay(void *ptr);
+static live_t *live_find(livemap_t *live, int id);
+static void live_add(livemap_t *live, int id, char *p, int size);
+static char *live_remove(livemap_t *live, int id, int *size);
+
+/* Routines for the lifetimes of blocks and placement by lifetime (-L) */
+static void eval_lifetimes(trace_t *trace, stats_t *stats);
+static void eval_mm_regions(trace_t *trace, stats_t *stats);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printmtresults(int n, stats_t *stats, int jobs, int partition);
+static void printlifetimes(int n, stats_t *stats);
+static void printheapstats(int n, stats_t *stats);
+static int cmp_int(const void *a, const void *b);
+static int cmp_ptr(const void *a, const void *b);
+static int peak_op(trace_t *trace);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
+static void edge_error(char *msg);
 static void app_error(char *msg);
 
 /**************
@@ -137,12 +304,13 @@ static void app_error(char *msg);
  **************/
 int main(int argc, char **argv)
 {
-    int i;
+    int i, n;
+    size_t heapsize;           /* heap used by one run of the current trace */
     char c;
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
     trace_t *trace = NULL;     /* stores a single trace file in memory */
-    range_t *ranges = NULL;    /* keeps track of block extents for one trace */
+    ranges_t ranges = {0};     /* keeps track of block extents for one trace */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
@@ -150,6 +318,11 @@ int main(int argc, char **argv)
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int jobs = 1;        /* If > 1, also replay each trace from jobs threads (-j) */
+    int partition = 0;   /* If set, the -j threads split each trace (-p) */
+    int lifetimes = 0;   /* If set, report block lifetimes and regions (-L) */
+    char *binfile = NULL;/* If set, write the -f trace here in binary and exit (-w) */
+    char *streamfile = NULL; /* If set, only stream this trace through mm (-s) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,7 +331,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:j:P:c:w:s:hvVgalpL")) != EOF) {
         switch (c) {
         case 'g': /* Generate summary info for the autograder */
             autograder = 1;
@@ -178,12 +351,41 @@ int main(int argc, char **argv)
             if (tracedir[strlen(tracedir)-1] != '/') 
                 strcat(tracedir, "/"); /* path always ends with "/" */
             break;
+        case 's': /* Replay one trace as it is read, without loading it */
+            streamfile = optarg;
+            break;
+        case 'w': /* Convert the -f trace to a binary trace file */
+            binfile = optarg;
+            break;
         case 'a': /* Don't check team structure */
             team_check = 0;
             break;
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'j': /* Also replay each trace from this many threads */
+            jobs = atoi(optarg);
+            if (jobs < 1 || jobs > MAXJOBS) {
+                fprintf(stderr, "-j must be between 1 and %d\n", MAXJOBS);
+                exit(1);
+            }
+            break;
+        case 'p': /* Split each trace among the -j threads instead */
+            partition = 1;
+            break;
+        case 'c': /* Check the heap after every op of the correctness pass */
+            check_level = atoi(optarg);
+            if (check_level < MM_CHECK_OFF || check_level > MM_CHECK_FULL) {
+                fprintf(stderr, "-c must be between %d and %d\n", MM_CHECK_OFF, MM_CHECK_FULL);
+                exit(1);
+            }
+            break;
+        case 'P': /* Profile the heap, sampling once every so many bytes */
+            profile = atol(optarg);
+            break;
+        case 'L': /* Report lifetimes and place short-lived blocks apart */
+            lifetimes = 1;
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -199,6 +401,18 @@ int main(int argc, char **argv)
         }
     }
 	
+    /* Just convert a trace, without running anything */
+    if (binfile != NULL) {
+        if (tracefiles == NULL) {
+            fprintf(stderr, "-w needs the trace to convert, given with -f\n");
+            exit(1);
+        }
+        trace = read_trace(tracedir, tracefiles[0]);
+        write_trace(trace, binfile);
+        free_trace(trace);
+        exit(0);
+    }
+
     /* 
      * Check and print team info 
      */
@@ -225,6 +439,13 @@ int main(int argc, char **argv)
             printf("Member 2 :%s:%s\n", team.name2, team.id2);
     }
 
+    /* Just stream one trace through the mm package */
+    if (streamfile != NULL) {
+        mem_init();
+        eval_mm_stream(streamfile);
+        exit(0);
+    }
+
     /* 
      * If no -f command line arg, then use the entire set of tracefiles 
      * defined in default_traces[]
@@ -287,6 +508,11 @@ int main(int argc, char **argv)
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
 
+    /* Check the requests no trace can make */
+    if (verbose > 1)
+        printf("Checking mm_malloc edge cases.\n");
+    eval_mm_edges();
+
     /* Evaluate student's mm malloc package using the K-best scheme */
     for (i=0; i < num_tracefiles; i++) {
         trace = read_trace(tracedir, tracefiles[i]);
@@ -297,12 +523,37 @@ int main(int argc, char **argv)
         if (mm_stats[i].valid) {
             if (verbose > 1)
                 printf("efficiency, ");
-            mm_stats[i].util = eval_mm_util(trace, i, &ranges);
+            mm_prof_start(profile);
+            mm_stats[i].util = eval_mm_util(trace, i, &ranges,
+                                            verbose ? &mm_stats[i].heap : NULL);
+            mm_prof_start(0);
+            heapsize = mem_heapsize_peak();
             speed_params.trace = trace;
-            speed_params.ranges = ranges;
+            speed_params.ranges = &ranges;
             if (verbose > 1)
                 printf("and performance.\n");
             mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+
+            /* Replay the trace from 1 to jobs threads at once on one
+               heap, as long as jobs copies of it fit in the simulated heap */
+            if (jobs > 1 && !partition && jobs * heapsize > MAX_HEAP) {
+                printf("Skipping %d-thread replay of %s: needs about %zu bytes of heap\n",
+                       jobs, tracefiles[i], jobs * heapsize);
+            }
+            else if (jobs > 1) {
+                if (verbose > 1)
+                    printf("Replaying from 1 to %d threads.\n", jobs);
+                for (n = 1; n <= jobs; n++)
+                    eval_mm_mt(trace, n, partition, &mm_stats[i]);
+            }
+
+            /* Replay the trace once more, telling mm which blocks die young */
+            if (lifetimes) {
+                if (verbose > 1)
+                    printf("Replaying with lifetime hints.\n");
+                eval_lifetimes(trace, &mm_stats[i]);
+                eval_mm_regions(trace, &mm_stats[i]);
+            }
         }
         free_trace(trace);
     }
@@ -311,6 +562,20 @@ int main(int argc, char **argv)
     if (verbose) {
         printf("\nResults for mm malloc:\n");
         printresults(num_tracefiles, mm_stats);
+        printf("\nHeap at the peak of the live payload:\n");
+        printheapstats(num_tracefiles, mm_stats);
+        printf("\n");
+    }
+    if (lifetimes) {
+        printf("Lifetimes and regions for mm malloc (short-lived: freed within %d ops):\n",
+               SHORT_LIFETIME);
+        printlifetimes(num_tracefiles, mm_stats);
+        printf("\n");
+    }
+    if (jobs > 1) {
+        printf("Results for mm malloc with %d threads%s:\n", jobs,
+               partition ? " splitting each trace" : "");
+        printmtresults(num_tracefiles, mm_stats, jobs, partition);
         printf("\n");
     }
 
@@ -367,100 +632,215 @@ int main(int argc, char **argv)
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
- * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * The following routines manipulate the range set, which keeps
+ * track of the extent of every allocated block payload. We use the
+ * range set to detect any overlapping allocated blocks. Adding and
+ * removing a range take O(log n) time, so that traces with hundreds
+ * of thousands of live blocks can still be checked.
  ****************************************************************/
 
 /*
  * add_range - As directed by request opnum in trace tracenum,
- *     we've just called the student's mm_malloc to allocate a block of 
- *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     we've just called the student's mm_malloc to allocate a block of
+ *     size bytes at addr lo, which must be align-byte aligned. After
+ *     checking the block for correctness, we create a range struct for
+ *     this block and add it to the range set.
  */
-static int add_range(range_t **ranges, char *lo, int size, 
+static int add_range(ranges_t *ranges, char *lo, int size, int align,
                      int tracenum, int opnum)
 {
     char *hi = lo + size - 1;
-    range_t *p;
+    range_t *p, *below, *above, *parent;
+    range_t **old;
+    size_t i, oldslots;
     char msg[MAXLINE];
 
     assert(size > 0);
 
-    /* Payload addresses must be ALIGNMENT-byte aligned */
-    if (!IS_ALIGNED(lo)) {
-        sprintf(msg, "Payload address (%p) not aligned to %d bytes", 
-                lo, ALIGNMENT);
+    /* Payload addresses must be align-byte aligned */
+    if (!IS_ALIGNED(lo, align)) {
+        sprintf(msg, "Payload address (%p) not aligned to %d bytes",
+                lo, align);
         malloc_error(tracenum, opnum, msg);
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-        (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
-        sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
+    /* The payload must lie within the extent of the heap,
+       or within one region the package mapped with mem_map */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
+         (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+        !mem_in_region(lo, hi)) {
+        sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p) and mapped regions",
                 lo, hi, mem_heap_lo(), mem_heap_hi());
         malloc_error(tracenum, opnum, msg);
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-            sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-                    lo, hi, p->lo, p->hi);
-            malloc_error(tracenum, opnum, msg);
-            return 0;
-        }
+    /* The payload must not overlap any other payloads. The live ones do
+       not overlap each other, so only the nearest one starting at or
+       below lo and the nearest one starting above it need checking. */
+    below = above = parent = NULL;
+    for (p = ranges->root;  p != NULL;  p = (lo < p->lo) ? p->left : p->right) {
+        parent = p;
+        if (lo < p->lo)
+            above = p;
+        else
+            below = p;
+    }
+    if (below != NULL && lo <= below->hi)
+        p = below;
+    else if (above != NULL && hi >= above->lo)
+        p = above;
+    if (p != NULL) {
+        sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+                lo, hi, p->lo, p->hi);
+        malloc_error(tracenum, opnum, msg);
+        return 0;
     }
 
-    /* 
-     * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+    /*
+     * Everything looks OK, so remember the extent of this block
+     * by creating a range struct and adding it to the range set.
      */
     if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
         unix_error("malloc error in add_range");
-    p->next = *ranges;
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    p->prio = range_hash((char *)~(size_t)lo);
+    p->left = p->right = NULL;
+    p->parent = parent;
+    if (parent == NULL)
+        ranges->root = p;
+    else if (lo < parent->lo)
+        parent->left = p;
+    else
+        parent->right = p;
+    while (p->parent != NULL && p->prio > p->parent->prio)
+        range_rotate_up(ranges, p);
+
+    /* Keep the hash at most half full */
+    if (2 * (ranges->count + 1) > ranges->nslots) {
+        old = ranges->slots;
+        oldslots = ranges->nslots;
+        ranges->nslots = oldslots ? 2 * oldslots : 1024;
+        if ((ranges->slots = (range_t **)calloc(ranges->nslots, sizeof(range_t *))) == NULL)
+            unix_error("calloc error in add_range");
+        for (i = 0; i < oldslots; i++)
+            if (old[i] != NULL)
+                ranges->slots[range_slot(ranges, old[i]->lo)] = old[i];
+        free(old);
+    }
+    ranges->slots[range_slot(ranges, lo)] = p;
+    ranges->count++;
     return 1;
 }
 
-/* 
- * remove_range - Free the range record of block whose payload starts at lo 
+/*
+ * remove_range - Free the range record of block whose payload starts at lo
  */
-static void remove_range(range_t **ranges, char *lo)
+static void remove_range(ranges_t *ranges, char *lo)
 {
-    range_t *p;
-    range_t **prevpp = ranges;
-    // int size;
+    range_t *p, *child;
+    size_t i, j, k, mask = ranges->nslots - 1;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-            *prevpp = p->next;
-            // size = p->hi - p->lo + 1;
-            free(p);
-            break;
+    if (ranges->count == 0 || (p = ranges->slots[i = range_slot(ranges, lo)]) == NULL)
+        return;
+
+    /* Rotate the range down to a leaf and cut it off the treap */
+    while (p->left != NULL || p->right != NULL) {
+        if (p->left == NULL || (p->right != NULL && p->right->prio > p->left->prio))
+            child = p->right;
+        else
+            child = p->left;
+        range_rotate_up(ranges, child);
+    }
+    if (p->parent == NULL)
+        ranges->root = NULL;
+    else if (p->parent->left == p)
+        p->parent->left = NULL;
+    else
+        p->parent->right = NULL;
+    free(p);
+
+    /* Empty its slot, shifting back the ranges that probed past it */
+    ranges->slots[i] = NULL;
+    for (j = (i + 1) & mask; ranges->slots[j] != NULL; j = (j + 1) & mask) {
+        k = range_hash(ranges->slots[j]->lo) & mask;
+        if (((j - k) & mask) >= ((j - i) & mask)) {
+            ranges->slots[i] = ranges->slots[j];
+            ranges->slots[j] = NULL;
+            i = j;
         }
-        prevpp = &(p->next);
     }
+    ranges->count--;
+}
+
+/*
+ * clear_ranges - free all of the range records for a trace
+ */
+static void clear_ranges(ranges_t *ranges)
+{
+    size_t i;
+
+    for (i = 0; i < ranges->nslots; i++) {
+        free(ranges->slots[i]);
+        ranges->slots[i] = NULL;
+    }
+    ranges->root = NULL;
+    ranges->count = 0;
+}
+
+/*
+ * range_hash - hash of a payload address, for its slot and its priority
+ */
+static size_t range_hash(char *lo)
+{
+    size_t h = (size_t)lo * 0x9e3779b97f4a7c15UL;
+
+    return h ^ (h >> 29);
 }
 
 /*
- * clear_ranges - free all of the range records for a trace 
+ * range_slot - the slot of the range starting at lo, or the empty slot
+ *     where it would go
  */
-static void clear_ranges(range_t **ranges)
+static size_t range_slot(ranges_t *ranges, char *lo)
 {
-    range_t *p;
-    range_t *pnext;
+    size_t mask = ranges->nslots - 1;
+    size_t i = range_hash(lo) & mask;
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
+    while (ranges->slots[i] != NULL && ranges->slots[i]->lo != lo)
+        i = (i + 1) & mask;
+    return i;
+}
+
+/*
+ * range_rotate_up - rotate range p above its parent, keeping the order
+ */
+static void range_rotate_up(ranges_t *ranges, range_t *p)
+{
+    range_t *parent = p->parent;
+    range_t *grandparent = parent->parent;
+
+    if (parent->left == p) {
+        parent->left = p->right;
+        if (p->right != NULL)
+            p->right->parent = parent;
+        p->right = parent;
+    } else {
+        parent->right = p->left;
+        if (p->left != NULL)
+            p->left->parent = parent;
+        p->left = parent;
     }
-    *ranges = NULL;
+    parent->parent = p;
+    p->parent = grandparent;
+    if (grandparent == NULL)
+        ranges->root = p;
+    else if (grandparent->left == parent)
+        grandparent->left = p;
+    else
+        grandparent->right = p;
 }
 
 
@@ -469,17 +849,18 @@ static void clear_ranges(range_t **ranges)
  *********************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * read_trace - read a trace file and store it in memory. A binary trace
+ *     file is mapped instead, see map_trace.
  */
 static trace_t *read_trace(char *tracedir, char *filename)
 {
     FILE *tracefile;
     trace_t *trace;
-    char type[MAXLINE];
+    tracehdr_t hdr;
+    traceop_t *op;
     char path[MAXLINE];
-    int index, size;
     int max_index = 0;
-    int op_index;
+    int op_index, last;
     int scan_result = 1;
 
     if (verbose > 1)
@@ -493,9 +874,18 @@ static trace_t *read_trace(char *tracedir, char *filename)
     strcpy(path, tracedir);
     strcat(path, filename);
     if ((tracefile = fopen(path, "r")) == NULL) {
-        sprintf(msg, "Could not open %s in read_trace", path);
+        sprintf(msg, "Could not open %.*s in read_trace", MAXLINE - 32, path);
         unix_error(msg);
     }
+    if (fread(&hdr, sizeof(hdr), 1, tracefile) == 1 &&
+        memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) == 0) {
+        map_trace(trace, tracefile, &hdr, path);
+        fclose(tracefile);
+        return trace;
+    }
+    rewind(tracefile);
+    trace->map = NULL;
+    trace->map_size = 0;
     scan_result &= fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
     scan_result &= fscanf(tracefile, "%d", &(trace->num_ids));     
     scan_result &= fscanf(tracefile, "%d", &(trace->num_ops));     
@@ -517,36 +907,14 @@ static trace_t *read_trace(char *tracedir, char *filename)
         unix_error("malloc 4 failed in read_trace");
     
     /* read every request line in the trace file */
-    index = 0;
     op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
-        switch(type[0]) {
-        case 'a':
-            scan_result &= fscanf(tracefile, "%u %u", &index, &size);
-            trace->ops[op_index].type = ALLOC;
-            trace->ops[op_index].index = index;
-            trace->ops[op_index].size = size;
-            max_index = (index > max_index) ? index : max_index;
-            break;
-        case 'r':
-            scan_result &= fscanf(tracefile, "%u %u", &index, &size);
-            trace->ops[op_index].type = REALLOC;
-            trace->ops[op_index].index = index;
-            trace->ops[op_index].size = size;
-            max_index = (index > max_index) ? index : max_index;
-            break;
-        case 'f':
-            scan_result &= fscanf(tracefile, "%ud", &index);
-            trace->ops[op_index].type = FREE;
-            trace->ops[op_index].index = index;
-            break;
-        default:
-            printf("Bogus type character (%c) in tracefile %s\n", 
-                   type[0], path);
-            exit(1);
+    while (read_op(tracefile, &trace->ops[op_index], path)) {
+        op = &trace->ops[op_index];
+        if (op->type != FREE && op->type != FREE_BATCH) {
+            last = op->index + (op->type == ALLOC_BATCH ? op->count - 1 : 0);
+            max_index = (last > max_index) ? last : max_index;
         }
         op_index++;
-	
     }
     fclose(tracefile);
     assert(max_index == trace->num_ids - 1);
@@ -555,13 +923,178 @@ static trace_t *read_trace(char *tracedir, char *filename)
     return trace;
 }
 
+/*
+ * read_op - read the next request line of a text trace file into op.
+ *     Returns 0 at the end of the file.
+ */
+static int read_op(FILE *tracefile, traceop_t *op, char *path)
+{
+    char type[MAXLINE];
+    int index, size, count, align;
+    int scan_result = 1;
+
+    if (fscanf(tracefile, "%s", type) == EOF)
+        return 0;
+    switch(type[0]) {
+    case 'a':
+        scan_result &= fscanf(tracefile, "%u %u", &index, &size);
+        op->type = ALLOC;
+        op->index = index;
+        op->size = size;
+        op->hint = MM_HINT_NONE;
+        break;
+    case 'r':
+        scan_result &= fscanf(tracefile, "%u %u", &index, &size);
+        op->type = REALLOC;
+        op->index = index;
+        op->size = size;
+        break;
+    case 'f':
+        scan_result &= fscanf(tracefile, "%ud", &index);
+        op->type = FREE;
+        op->index = index;
+        break;
+    case 'A': /* A index count size: alloc ids index..index+count-1 at once */
+        scan_result &= fscanf(tracefile, "%u %u %u", &index, &count, &size);
+        op->type = ALLOC_BATCH;
+        op->index = index;
+        op->count = count;
+        op->size = size;
+        op->hint = MM_HINT_NONE;
+        break;
+    case 'c': /* c index size: alloc index zeroed */
+        scan_result &= fscanf(tracefile, "%u %u", &index, &size);
+        op->type = CALLOC;
+        op->index = index;
+        op->size = size;
+        op->hint = MM_HINT_NONE;
+        break;
+    case 'm': /* m index align size: alloc index at an align-byte boundary */
+        scan_result &= fscanf(tracefile, "%u %u %u", &index, &align, &size);
+        op->type = MEMALIGN;
+        op->index = index;
+        op->align = align;
+        op->size = size;
+        op->hint = MM_HINT_NONE;
+        break;
+    case 'F': /* F index count: free ids index..index+count-1 at once */
+        scan_result &= fscanf(tracefile, "%u %u", &index, &count);
+        op->type = FREE_BATCH;
+        op->index = index;
+        op->count = count;
+        break;
+    default:
+        printf("Bogus type character (%c) in tracefile %s\n", 
+               type[0], path);
+        exit(1);
+    }
+    return 1;
+}
+
+/*
+ * map_trace - map the binary trace file path, open as tracefile with
+ *     header hdr, into trace. Its ops are copied on write only, when -L
+ *     gives them lifetime hints. Every op is checked first, since the
+ *     replay indexes the block arrays with them as they are.
+ */
+static void map_trace(trace_t *trace, FILE *tracefile, tracehdr_t *hdr, char *path)
+{
+    struct stat st;
+    int i;
+
+    if (hdr->op_size != (int)sizeof(traceop_t) || hdr->num_ops < 0 || hdr->num_ids < 0 ||
+        fstat(fileno(tracefile), &st) < 0 ||
+        (size_t)st.st_size != sizeof(tracehdr_t) + (size_t)hdr->num_ops * sizeof(traceop_t)) {
+        printf("Binary tracefile %s is truncated or from another build of mdriver\n", path);
+        exit(1);
+    }
+    trace->sugg_heapsize = hdr->sugg_heapsize;
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->weight = hdr->weight;
+    trace->map_size = st.st_size;
+    if ((trace->map = mmap(NULL, trace->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                           fileno(tracefile), 0)) == MAP_FAILED)
+        unix_error("mmap failed in map_trace");
+    trace->ops = (traceop_t *)((char *)trace->map + sizeof(tracehdr_t));
+
+    for (i = 0; i < trace->num_ops; i++) {
+        if (!op_ok(&trace->ops[i], trace->num_ids)) {
+            printf("Bogus op %d in binary tracefile %s\n", i, path);
+            exit(1);
+        }
+    }
+
+    if ((trace->blocks = 
+         (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+        unix_error("malloc 3 failed in map_trace");
+    if ((trace->block_sizes = 
+         (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+        unix_error("malloc 4 failed in map_trace");
+}
+
+/*
+ * op_ok - Returns whether op, read from a trace with num_ids ids, can be
+ *     replayed as it is: a known type, ids in range, and the fields its
+ *     type uses sensible. The fields it does not use are not looked at.
+ */
+static int op_ok(traceop_t *op, int num_ids)
+{
+    if ((unsigned)op->type > CALLOC || op->index < 0 || op->index >= num_ids)
+        return 0;
+    switch (op->type) {
+    case ALLOC_BATCH:
+    case FREE_BATCH:
+        if (op->count < 1 || op->count > num_ids - op->index)
+            return 0;
+        return op->type == FREE_BATCH || op->size >= 0;
+    case MEMALIGN:
+        if (op->align < 1 || (op->align & (op->align - 1)) != 0)
+            return 0;
+        return op->size >= 0;
+    case FREE:
+        return 1;
+    default:
+        return op->size >= 0;
+    }
+}
+
+/*
+ * write_trace - write trace to filename as a binary trace file
+ */
+static void write_trace(trace_t *trace, char *filename)
+{
+    FILE *binfile;
+    tracehdr_t hdr;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.sugg_heapsize = trace->sugg_heapsize;
+    hdr.num_ids = trace->num_ids;
+    hdr.num_ops = trace->num_ops;
+    hdr.weight = trace->weight;
+    hdr.op_size = sizeof(traceop_t);
+
+    if ((binfile = fopen(filename, "wb")) == NULL) {
+        sprintf(msg, "Could not open %.*s in write_trace", MAXLINE - 32, filename);
+        unix_error(msg);
+    }
+    if (fwrite(&hdr, sizeof(hdr), 1, binfile) != 1 ||
+        fwrite(trace->ops, sizeof(traceop_t), trace->num_ops, binfile) != (size_t)trace->num_ops ||
+        fclose(binfile) != 0)
+        unix_error("write failed in write_trace");
+}
+
 /*
  * free_trace - Free the trace record and the three arrays it points
  *              to, all of which were allocated in read_trace().
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    if (trace->map != NULL)   /* free the three arrays... */
+        munmap(trace->map, trace->map_size);
+    else
+        free(trace->ops);
     free(trace->blocks);      
     free(trace->block_sizes);
     free(trace);              /* and the trace record itself... */
@@ -575,17 +1108,19 @@ void free_trace(trace_t *trace)
 /*
  * eval_mm_valid - Check the mm malloc package for correctness
  */
-static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) 
+static int eval_mm_valid(trace_t *trace, int tracenum, ranges_t *ranges) 
 {
-    int i, j;
+    int i, j, k;
     int index;
     int size;
+    int count;
+    int align;
     int oldsize;
     char *newp;
     char *oldp;
     char *p;
     
-    /* Reset the heap and free any records in the range list */
+    /* Reset the heap and free any records in the range set */
     mem_reset_brk();
     clear_ranges(ranges);
 
@@ -612,10 +1147,10 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    
             /* 
              * Test the range of the new block for correctness and add it 
-             * to the range list if OK. The block must be  be aligned properly,
+             * to the range set if OK. The block must be  be aligned properly,
              * and must not overlap any currently allocated block. 
              */ 
-            if (add_range(ranges, p, size, tracenum, i) == 0)
+            if (add_range(ranges, p, size, ALIGNMENT, tracenum, i) == 0)
                 return 0;
 	    
             /* ADDED: cgw
@@ -639,11 +1174,11 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
                 return 0;
             }
 	    
-            /* Remove the old region from the range list */
+            /* Remove the old region from the range set */
             remove_range(ranges, oldp);
 	    
-            /* Check new block for correctness and add it to range list */
-            if (add_range(ranges, newp, size, tracenum, i) == 0)
+            /* Check new block for correctness and add it to range set */
+            if (add_range(ranges, newp, size, ALIGNMENT, tracenum, i) == 0)
                 return 0;
 	    
             /* ADDED: cgw
@@ -654,7 +1189,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
             oldsize = trace->block_sizes[index];
             if (size < oldsize) oldsize = size;
             for (j = 0; j < oldsize; j++) {
-                if (newp[j] != (index & 0xFF)) {
+                if ((unsigned char)newp[j] != (index & 0xFF)) {
                     malloc_error(tracenum, i, "mm_realloc did not preserve the "
                                  "data from old block");
                     return 0;
@@ -675,10 +1210,76 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
             mm_free(p);
             break;
 
+        case CALLOC: /* mm_calloc */
+
+            if ((p = mm_calloc(1, size)) == NULL) {
+                malloc_error(tracenum, i, "mm_calloc failed.");
+                return 0;
+            }
+            if (add_range(ranges, p, size, ALIGNMENT, tracenum, i) == 0)
+                return 0;
+            for (j = 0; j < size; j++) {
+                if (p[j] != 0) {
+                    malloc_error(tracenum, i, "mm_calloc did not zero the block");
+                    return 0;
+                }
+            }
+            memset(p, index & 0xFF, size);
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            break;
+
+        case MEMALIGN: /* mm_memalign */
+
+            /* An alignment below ALIGNMENT still gets ALIGNMENT */
+            align = trace->ops[i].align;
+            if (align < ALIGNMENT)
+                align = ALIGNMENT;
+            if ((p = mm_memalign(trace->ops[i].align, size)) == NULL) {
+                malloc_error(tracenum, i, "mm_memalign failed.");
+                return 0;
+            }
+            if (add_range(ranges, p, size, align, tracenum, i) == 0)
+                return 0;
+            memset(p, index & 0xFF, size);
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            break;
+
+        case ALLOC_BATCH: /* mm_malloc_batch */
+
+            count = trace->ops[i].count;
+            if (mm_malloc_batch(size, count, (void **)&trace->blocks[index]) < (size_t)count) {
+                malloc_error(tracenum, i, "mm_malloc_batch failed.");
+                return 0;
+            }
+
+            /* Check and fill in each block just like a single mm_malloc */
+            for (k = index; k < index + count; k++) {
+                p = trace->blocks[k];
+                if (add_range(ranges, p, size, ALIGNMENT, tracenum, i) == 0)
+                    return 0;
+                memset(p, k & 0xFF, size);
+                trace->block_sizes[k] = size;
+            }
+            break;
+
+        case FREE_BATCH: /* mm_free_batch */
+
+            count = trace->ops[i].count;
+            for (k = index; k < index + count; k++)
+                remove_range(ranges, trace->blocks[k]);
+            mm_free_batch((void **)&trace->blocks[index], count);
+            break;
+
         default:
             app_error("Nonexistent request type in eval_mm_valid");
         }
 
+        if (check_level != MM_CHECK_OFF && !mm_checkheap(check_level)) {
+            malloc_error(tracenum, i, "mm_checkheap found the heap inconsistent.");
+            return 0;
+        }
     }
 
     /* As far as we know, this is a valid malloc package */
@@ -690,18 +1291,21 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for 
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
- *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
- *   
+ *   high water mark of the brk pointer while running the student's
+ *   malloc package on the trace. mem_sbrk() lets the package shrink
+ *   the heap, so this is not necessarily the final size of the heap.
+ *   If heap is not NULL, it gets the mm_stats snapshot taken when the
+ *   live payload peaks, with the split and coalesce counts of the
+ *   whole trace. With -P, the heap profile is printed at that point too.
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
+static double eval_mm_util(trace_t *trace, int tracenum, ranges_t *ranges,
+                           mm_stats_t *heap)
 {   
-    int i;
-    int index;
+    int i, k;
+    int index, count;
     int size, newsize, oldsize;
     int max_total_size = 0;
+    int peak = (profile > 0 || heap != NULL) ? peak_op(trace) : -1;
     int total_size = 0;
     char *p;
     char *newp, *oldp;
@@ -715,10 +1319,18 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_alloc */
+        case MEMALIGN: /* mm_memalign */
+        case CALLOC: /* mm_calloc */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
 
-            if ((p = mm_malloc(size)) == NULL) 
+            if (trace->ops[i].type == MEMALIGN)
+                p = mm_memalign(trace->ops[i].align, size);
+            else if (trace->ops[i].type == CALLOC)
+                p = mm_calloc(1, size);
+            else
+                p = mm_malloc(size);
+            if (p == NULL) 
                 app_error("mm_malloc failed in eval_mm_util");
 	    
             /* Remember region and size */
@@ -769,82 +1381,968 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    
             break;
 
+        case ALLOC_BATCH: /* mm_malloc_batch */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            count = trace->ops[i].count;
+
+            if (mm_malloc_batch(size, count, (void **)&trace->blocks[index]) < (size_t)count)
+                app_error("mm_malloc_batch failed in eval_mm_util");
+            for (k = index; k < index + count; k++)
+                trace->block_sizes[k] = size;
+
+            total_size += size * count;
+            max_total_size = (total_size > max_total_size) ?
+                total_size : max_total_size;
+            break;
+
+        case FREE_BATCH: /* mm_free_batch */
+            index = trace->ops[i].index;
+            count = trace->ops[i].count;
+
+            for (k = index; k < index + count; k++)
+                total_size -= trace->block_sizes[k];
+            mm_free_batch((void **)&trace->blocks[index], count);
+            break;
+
         default:
             app_error("Nonexistent request type in eval_mm_util");
 
         }
+
+        /* Snapshot the heap once, when the live payload first peaks */
+        if (i == peak && heap != NULL)
+            mm_stats(heap);
+        if (i == peak && profile > 0) {
+            printf("\nHeap profile of trace %d at the peak of its live payload:\n",
+                   tracenum);
+            mm_prof_dump(stdout);
+        }
+    }
+
+    if (heap != NULL) {
+        mm_stats_t last;
+
+        mm_stats(&last);
+        heap->splits = last.splits;
+        heap->coalesces = last.coalesces;
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)mem_heapsize_peak());
 }
 
 
+/*
+ * peak_op - Returns the index of the op after which the trace has the
+ *   most payload allocated. Uses trace->block_sizes as scratch space.
+ */
+static int peak_op(trace_t *trace)
+{
+    int i, k, index;
+    int total_size = 0, max_total_size = 0, peak = 0;
+
+    for (i = 0; i < trace->num_ops; i++) {
+        index = trace->ops[i].index;
+        switch (trace->ops[i].type) {
+        case ALLOC:
+        case MEMALIGN:
+        case CALLOC:
+            trace->block_sizes[index] = trace->ops[i].size;
+            total_size += trace->ops[i].size;
+            break;
+        case REALLOC:
+            total_size += trace->ops[i].size - (int)trace->block_sizes[index];
+            trace->block_sizes[index] = trace->ops[i].size;
+            break;
+        case FREE:
+            total_size -= (int)trace->block_sizes[index];
+            break;
+        case ALLOC_BATCH:
+            for (k = index; k < index + trace->ops[i].count; k++)
+                trace->block_sizes[k] = trace->ops[i].size;
+            total_size += trace->ops[i].size * trace->ops[i].count;
+            break;
+        case FREE_BATCH:
+            for (k = index; k < index + trace->ops[i].count; k++)
+                total_size -= (int)trace->block_sizes[k];
+            break;
+        }
+        if (total_size > max_total_size) {
+            max_total_size = total_size;
+            peak = i;
+        }
+    }
+    return peak;
+}
+
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
  *    to measure the running time of the mm malloc package.
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size, newsize;
-    char *p, *newp, *oldp, *block;
-    trace_t *trace = ((speed_t *)ptr)->trace;
+    replay_t replay;
+
+    replay.trace = ((speed_t *)ptr)->trace;
+    replay.blocks = replay.trace->blocks;
 
     /* Reset the heap and initialize the mm package */
     mem_reset_brk();
     if (mm_init() < 0) 
         app_error("mm_init failed in eval_mm_speed");
 
-    /* Interpret each trace request */
-    for (i = 0;  i < trace->num_ops;  i++)
-        switch (trace->ops[i].type) {
-
-        case ALLOC: /* mm_malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
-                app_error("mm_malloc error in eval_mm_speed");
-            trace->blocks[index] = p;
-            break;
+    mm_replay(&replay);
+}
 
-        case REALLOC: /* mm_realloc */
-            index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
-            oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL)
-                app_error("mm_realloc error in eval_mm_speed");
-            trace->blocks[index] = newp;
-            break;
+/*
+ * eval_mm_mt - Time jobs threads replaying trace at once on one heap,
+ *    each the whole trace or, partitioned, its share of it. Fills in
+ *    the jobs point of the scalability curve in stats, and the time
+ *    each of the threads took.
+ */
+static void eval_mm_mt(trace_t *trace, int jobs, int partition, stats_t *stats)
+{
+    speed_t params;
+    part_t part;
+    int j;
+
+    params.trace = trace;
+    params.jobs = jobs;
+    params.part = NULL;
+    if (partition) {
+        partition_trace(trace, jobs, &part);
+        params.part = &part;
+    }
+    for (j = 0; j < jobs; j++) {
+        params.thread_secs[j] = DBL_MAX;
+        if (partition)
+            params.blocks[j] = trace->blocks;
+        else if ((params.blocks[j] = (char **)
+                  malloc(trace->num_ids * sizeof(char *))) == NULL)
+            unix_error("malloc of thread blocks failed in eval_mm_mt");
+    }
 
-        case FREE: /* mm_free */
-            index = trace->ops[i].index;
-            block = trace->blocks[index];
-            mm_free(block);
-            break;
+    stats->mt_secs[jobs] = fsecs(eval_mm_mt_speed, &params);
 
-        default:
-            app_error("Nonexistent request type in eval_mm_valid");
-        }
+    for (j = 0; j < jobs; j++) {
+        stats->thread_ops[j] = partition ? part.nops[j] : trace->num_ops;
+        stats->thread_secs[j] = params.thread_secs[j];
+        if (!partition)
+            free(params.blocks[j]);
+    }
+    if (partition)
+        free_partition(&part);
 }
 
 /*
- * eval_libc_valid - We run this function to make sure that the
- *    libc malloc can run to completion on the set of traces.
- *    We'll be conservative and terminate if any libc malloc call fails.
- *
+ * eval_mm_mt_speed - This is the function that is used by fcyc() to
+ *    measure the running time of jobs threads that each run the whole
+ *    trace, or their share of it, at the same time against one mm heap.
+ *    The threads wait at a barrier, so that none starts before all of
+ *    them exist.
  */
-static int eval_libc_valid(trace_t *trace, int tracenum)
+static void eval_mm_mt_speed(void *ptr)
 {
-    int i, newsize;
-    char *p, *newp, *oldp;
+    speed_t *params = (speed_t *)ptr;
+    pthread_t tids[MAXJOBS];
+    replay_t replays[MAXJOBS];
+    pthread_barrier_t start;
+    int i;
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0) 
+        app_error("mm_init failed in eval_mm_mt_speed");
+    if (params->part != NULL)
+        memset(params->part->done, 0, params->trace->num_ids * sizeof(int));
+
+    pthread_barrier_init(&start, NULL, params->jobs);
+    for (i = 0; i < params->jobs; i++) {
+        replays[i].trace = params->trace;
+        replays[i].blocks = params->blocks[i];
+        replays[i].part = params->part;
+        replays[i].thread = i;
+        replays[i].start = &start;
+        if (pthread_create(&tids[i], NULL, mm_replay_thread, &replays[i]) != 0)
+            unix_error("pthread_create failed in eval_mm_mt_speed");
+    }
+    for (i = 0; i < params->jobs; i++) {
+        pthread_join(tids[i], NULL);
+        if (replays[i].secs < params->thread_secs[i])
+            params->thread_secs[i] = replays[i].secs;
+    }
+    pthread_barrier_destroy(&start);
+}
 
-        case ALLOC: /* malloc */
-            if ((p = malloc(trace->ops[i].size)) == NULL) {
-                malloc_error(tracenum, i, "libc malloc failed");
-                unix_error("System message");
-            }
+/*
+ * partition_trace - Split trace among jobs threads. Each op runs on
+ *    thread index % jobs, except that frees run on the next thread, so
+ *    that every block is freed by another thread than allocated it.
+ */
+static void partition_trace(trace_t *trace, int jobs, part_t *part)
+{
+    int i, k, t, ids = 0;
+    traceop_t *op;
+
+    for (i = 0; i < trace->num_ops; i++)
+        ids += OP_IDS(&trace->ops[i]);
+    if ((part->first = (int *)malloc(trace->num_ops * sizeof(int))) == NULL ||
+        (part->expect = (int *)malloc(ids * sizeof(int))) == NULL ||
+        (part->done = (int *)calloc(trace->num_ids, sizeof(int))) == NULL)
+        unix_error("malloc failed in partition_trace");
+
+    /* Count each thread's ops, then list them */
+    part->jobs = jobs;
+    for (t = 0; t < jobs; t++)
+        part->nops[t] = 0;
+    for (i = 0; i < trace->num_ops; i++) {
+        op = &trace->ops[i];
+        part->nops[(op->index + (op->type == FREE || op->type == FREE_BATCH)) % jobs]++;
+    }
+    for (t = 0; t < jobs; t++) {
+        if ((part->ops[t] = (int *)malloc((part->nops[t] + 1) * sizeof(int))) == NULL)
+            unix_error("malloc failed in partition_trace");
+        part->nops[t] = 0;
+    }
+    for (i = ids = 0; i < trace->num_ops; i++) {
+        op = &trace->ops[i];
+        t = (op->index + (op->type == FREE || op->type == FREE_BATCH)) % jobs;
+        part->ops[t][part->nops[t]++] = i;
+        part->first[i] = ids;
+        for (k = 0; k < OP_IDS(op); k++)
+            part->expect[ids++] = part->done[op->index + k]++;
+    }
+}
+
+/*
+ * free_partition - Free the arrays partition_trace allocated
+ */
+static void free_partition(part_t *part)
+{
+    int t;
+
+    for (t = 0; t < part->jobs; t++)
+        free(part->ops[t]);
+    free(part->first);
+    free(part->expect);
+    free(part->done);
+}
+
+/*
+ * eval_lifetimes - Find how many ops each block of the trace lives for,
+ *    from its alloc to its free (reallocs don't end a block's life, and
+ *    a block that is never freed lives to the end of the trace). Allocs
+ *    of blocks that live at most SHORT_LIFETIME ops get MM_HINT_SHORT.
+ */
+static void eval_lifetimes(trace_t *trace, stats_t *stats)
+{
+    int i, index, first, last, n = 0, nshort = 0, nallocs = 0;
+    int *born;    /* op that allocated each live id, or -1 */
+    int *lives;   /* lifetime of each block, in ops */
+
+    for (i = 0; i < trace->num_ops; i++)
+        nallocs += (trace->ops[i].type == ALLOC_BATCH) ? trace->ops[i].count : 1;
+    if ((born = (int *)malloc(trace->num_ids * sizeof(int))) == NULL ||
+        (lives = (int *)malloc(nallocs * sizeof(int))) == NULL)
+        unix_error("malloc failed in eval_lifetimes");
+    for (i = 0; i < trace->num_ids; i++)
+        born[i] = -1;
+
+    for (i = 0; i < trace->num_ops; i++) {
+        first = trace->ops[i].index;
+        last = first + ((trace->ops[i].type == ALLOC_BATCH ||
+                         trace->ops[i].type == FREE_BATCH) ? trace->ops[i].count : 1);
+        for (index = first; index < last; index++) {
+            if (trace->ops[i].type == ALLOC || trace->ops[i].type == ALLOC_BATCH ||
+                trace->ops[i].type == MEMALIGN || trace->ops[i].type == CALLOC) {
+                born[index] = i;
+            }
+            else if ((trace->ops[i].type == FREE || trace->ops[i].type == FREE_BATCH) &&
+                     born[index] >= 0) {
+                lives[n++] = i - born[index];
+                /* only plain allocs have a hint of their own */
+                if (i - born[index] <= SHORT_LIFETIME && trace->ops[born[index]].type == ALLOC)
+                    trace->ops[born[index]].hint = MM_HINT_SHORT;
+                born[index] = -1;
+            }
+        }
+    }
+    for (i = 0; i < trace->num_ids; i++)
+        if (born[i] >= 0)
+            lives[n++] = trace->num_ops - born[i];
+
+    qsort(lives, n, sizeof(int), cmp_int);
+    for (i = 0; i < n; i++)
+        nshort += (lives[i] <= SHORT_LIFETIME);
+
+    stats->blocks = n;
+    stats->median_life = (n > 0) ? lives[n / 2] : 0;
+    stats->short_frac = (n > 0) ? (double)nshort / n : 0;
+    free(born);
+    free(lives);
+}
+
+/*
+ * eval_mm_regions - Replay the trace with the hints from eval_lifetimes
+ *    and measure the space utilization of the whole heap and of each
+ *    region: the peak payload in the region over the peak size of it.
+ */
+static void eval_mm_regions(trace_t *trace, stats_t *stats)
+{
+    int i, k, r, index, size, oldsize, count;
+    char *p, *newp;
+    double live[2] = {0, 0};
+    double max_live[2] = {0, 0};
+    double max_size[2] = {0, 0};
+    double max_total = 0;
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("mm_init failed in eval_mm_regions");
+
+    for (i = 0; i < trace->num_ops; i++) {
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        switch (trace->ops[i].type) {
+
+        case ALLOC:
+            if ((p = mm_malloc_hint(size, trace->ops[i].hint)) == NULL)
+                app_error("mm_malloc_hint failed in eval_mm_regions");
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            live[mm_region(p)] += size;
+            break;
+
+        case REALLOC:
+            p = trace->blocks[index];
+            oldsize = trace->block_sizes[index];
+            live[mm_region(p)] -= oldsize;
+            if ((newp = mm_realloc(p, size)) == NULL)
+                app_error("mm_realloc failed in eval_mm_regions");
+            trace->blocks[index] = newp;
+            trace->block_sizes[index] = size;
+            live[mm_region(newp)] += size;
+            break;
+
+        case FREE:
+            p = trace->blocks[index];
+            live[mm_region(p)] -= trace->block_sizes[index];
+            mm_free(p);
+            break;
+
+        case MEMALIGN:
+        case CALLOC:
+            if (trace->ops[i].type == MEMALIGN)
+                p = mm_memalign(trace->ops[i].align, size);
+            else
+                p = mm_calloc(1, size);
+            if (p == NULL)
+                app_error("mm_memalign or mm_calloc failed in eval_mm_regions");
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            live[mm_region(p)] += size;
+            break;
+
+        case ALLOC_BATCH:
+            count = trace->ops[i].count;
+            if (mm_malloc_batch(size, count, (void **)&trace->blocks[index]) < (size_t)count)
+                app_error("mm_malloc_batch failed in eval_mm_regions");
+            for (k = index; k < index + count; k++) {
+                trace->block_sizes[k] = size;
+                live[mm_region(trace->blocks[k])] += size;
+            }
+            break;
+
+        case FREE_BATCH:
+            count = trace->ops[i].count;
+            for (k = index; k < index + count; k++)
+                live[mm_region(trace->blocks[k])] -= trace->block_sizes[k];
+            mm_free_batch((void **)&trace->blocks[index], count);
+            break;
+        }
+
+        for (r = 0; r < 2; r++) {
+            if (live[r] > max_live[r])
+                max_live[r] = live[r];
+            if (mm_region_size(r) > max_size[r])
+                max_size[r] = mm_region_size(r);
+        }
+        if (live[0] + live[1] > max_total)
+            max_total = live[0] + live[1];
+    }
+
+    stats->hint_util = max_total / mem_heapsize_peak();
+    for (r = 0; r < 2; r++)
+        stats->region_util[r] = (max_size[r] > 0) ? max_live[r] / max_size[r] : 0;
+}
+
+/*
+ * replay_op - Interpret one request of a trace with the mm package,
+ *    keeping the block pointers in blocks
+ */
+static inline void replay_op(traceop_t *op, char **blocks)
+{
+    int index, size, newsize, count;
+    char *p, *newp, *oldp, *block;
+
+    switch (op->type) {
+
+    case ALLOC: /* mm_malloc */
+        index = op->index;
+        size = op->size;
+        if ((p = mm_malloc(size)) == NULL)
+            app_error("mm_malloc error in eval_mm_speed");
+        blocks[index] = p;
+        break;
+
+    case REALLOC: /* mm_realloc */
+        index = op->index;
+        newsize = op->size;
+        oldp = blocks[index];
+        if ((newp = mm_realloc(oldp,newsize)) == NULL)
+            app_error("mm_realloc error in eval_mm_speed");
+        blocks[index] = newp;
+        break;
+
+    case FREE: /* mm_free */
+        index = op->index;
+        block = blocks[index];
+        mm_free(block);
+        break;
+
+    case MEMALIGN: /* mm_memalign */
+        index = op->index;
+        if ((p = mm_memalign(op->align, op->size)) == NULL)
+            app_error("mm_memalign error in eval_mm_speed");
+        blocks[index] = p;
+        break;
+
+    case CALLOC: /* mm_calloc */
+        index = op->index;
+        if ((p = mm_calloc(1, op->size)) == NULL)
+            app_error("mm_calloc error in eval_mm_speed");
+        blocks[index] = p;
+        break;
+
+    case ALLOC_BATCH: /* mm_malloc_batch */
+        index = op->index;
+        count = op->count;
+        if (mm_malloc_batch(op->size, count, (void **)&blocks[index]) < (size_t)count)
+            app_error("mm_malloc_batch error in eval_mm_speed");
+        break;
+
+    case FREE_BATCH: /* mm_free_batch */
+        index = op->index;
+        mm_free_batch((void **)&blocks[index], op->count);
+        break;
+
+    default:
+        app_error("Nonexistent request type in eval_mm_valid");
+    }
+}
+
+/*
+ * mm_replay - Interpret each request of a trace with the mm package,
+ *    keeping the block pointers in replay->blocks
+ */
+static void mm_replay(void *ptr)
+{
+    trace_t *trace = ((replay_t *)ptr)->trace;
+    char **blocks = ((replay_t *)ptr)->blocks;
+    int i;
+
+    for (i = 0;  i < trace->num_ops;  i++)
+        replay_op(&trace->ops[i], blocks);
+}
+
+/*
+ * mm_replay_part - Interpret this thread's share of a partitioned
+ *    trace, waiting before each op for the earlier ops on its ids
+ */
+static void mm_replay_part(void *ptr)
+{
+    replay_t *replay = (replay_t *)ptr;
+    part_t *part = replay->part;
+    traceop_t *op;
+    int i, j, k;
+
+    for (j = 0; j < part->nops[replay->thread]; j++) {
+        i = part->ops[replay->thread][j];
+        op = &replay->trace->ops[i];
+        for (k = 0; k < OP_IDS(op); k++)
+            while (__atomic_load_n(&part->done[op->index + k], __ATOMIC_ACQUIRE) !=
+                   part->expect[part->first[i] + k])
+                sched_yield();
+        replay_op(op, replay->blocks);
+        for (k = 0; k < OP_IDS(op); k++)
+            __atomic_store_n(&part->done[op->index + k], part->expect[part->first[i] + k] + 1,
+                             __ATOMIC_RELEASE);
+    }
+}
+
+/*
+ * mm_replay_thread - Run one thread of eval_mm_mt_speed, timing its
+ *    replay from the moment all of them start
+ */
+static void *mm_replay_thread(void *ptr)
+{
+    replay_t *replay = (replay_t *)ptr;
+
+    pthread_barrier_wait(replay->start);
+    replay->secs = ftimer_gettod(replay->part != NULL ? mm_replay_part : mm_replay, replay, 1);
+    return NULL;
+}
+
+/*
+ * eval_mm_edges - Check the mm package on what no trace can express:
+ *    requests that must fail cleanly, or succeed as much through
+ *    mm_realloc as through mm_malloc, whether the heap profiler forgets
+ *    sampled blocks once they are freed, and whether a block freed again
+ *    by mm_free_batch is handed out twice
+ */
+static void eval_mm_edges(void)
+{
+    size_t huge[] = {(size_t)-1, (size_t)-1 - 8, (size_t)-1 - 4096, (size_t)1 << 62};
+    size_t cached[] = {32, 100};   /* a slab object, and a heap block of cache size */
+    void *blocks[64];
+    size_t i, bytes, samples;
+    char *p, *q;
+    FILE *fp;
+    pid_t pid;
+    int status;
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("mm_init failed in eval_mm_edges");
+
+    /* Sizes whose block, padding and all, would not fit in a size_t */
+    for (i = 0; i < sizeof(huge) / sizeof(huge[0]); i++) {
+        if ((p = mm_malloc(huge[i])) != NULL) {
+            sprintf(msg, "mm_malloc(%zu) returned %p instead of NULL", huge[i], p);
+            edge_error(msg);
+        }
+    }
+    if ((p = mm_calloc(2, (size_t)-1 / 2)) != NULL) {
+        sprintf(msg, "mm_calloc(2, %zu) returned %p instead of NULL", (size_t)-1 / 2, p);
+        edge_error(msg);
+    }
+    if ((p = mm_calloc((size_t)-1 / 2, 3)) != NULL) {
+        sprintf(msg, "mm_calloc(%zu, 3) returned %p instead of NULL", (size_t)-1 / 2, p);
+        edge_error(msg);
+    }
+    if ((q = mm_malloc(100)) == NULL)
+        app_error("mm_malloc failed in eval_mm_edges");
+    for (i = 0; i < sizeof(huge) / sizeof(huge[0]); i++) {
+        if ((p = mm_realloc(q, huge[i])) != NULL) {
+            sprintf(msg, "mm_realloc(%p, %zu) returned %p instead of NULL", q, huge[i], p);
+            edge_error(msg);
+            q = p;
+        }
+    }
+
+    /* and mm_realloc must grant what mm_malloc grants, however big */
+    if ((p = mm_malloc(3UL << 30)) != NULL) {
+        mm_free(p);
+        if ((p = mm_realloc(q, 3UL << 30)) == NULL) {
+            sprintf(msg, "mm_realloc(%p, %lu) failed, though mm_malloc of that size did not",
+                    q, 3UL << 30);
+            edge_error(msg);
+        } else
+            q = p;
+    }
+    mm_free(q);
+
+    /* Sample every block, free them all at once, and no sample may be left */
+    mm_prof_start(1);
+    /* while it was off, this thread only checked every megabyte or so */
+    mm_free(mm_malloc(1 << 21));
+    for (i = 0; i < 64; i++)
+        if ((blocks[i] = mm_malloc(100)) == NULL)
+            app_error("mm_malloc failed in eval_mm_edges");
+    mm_free_batch(blocks, 64);
+    if ((fp = tmpfile()) == NULL)
+        unix_error("tmpfile failed in eval_mm_edges");
+    mm_prof_dump(fp);
+    rewind(fp);
+    if (fscanf(fp, "heap profile: %zu live bytes in %zu samples", &bytes, &samples) != 2)
+        app_error("Bad heap profile in eval_mm_edges");
+    if (samples != 0) {
+        sprintf(msg, "%zu live bytes in %zu samples left after mm_free_batch", bytes, samples);
+        edge_error(msg);
+    }
+    fclose(fp);
+    mm_prof_start(0);
+
+    /* Free a cached block again through mm_free_batch, in a child process
+       since that may well abort; it must not come back from two mallocs */
+    for (i = 0; i < sizeof(cached) / sizeof(cached[0]); i++) {
+        fflush(stdout);
+        if ((pid = fork()) < 0)
+            unix_error("fork failed in eval_mm_edges");
+        if (pid == 0) {
+            if (freopen("/dev/null", "w", stdout) == NULL ||
+                freopen("/dev/null", "w", stderr) == NULL)
+                _exit(2);
+            /* enough requests that the size gets slab runs, if it can */
+            for (status = 0; status < 64; status++)
+                mm_malloc(cached[i]);
+            p = mm_malloc(cached[i]);
+            mm_free(p);
+            mm_free_batch((void **)&p, 1);
+            /* drain the cache and then some, and look for p twice */
+            for (status = 0; status < 64; status++)
+                blocks[status] = mm_malloc(cached[i]);
+            qsort(blocks, 64, sizeof(void *), cmp_ptr);
+            for (status = 1; status < 64; status++)
+                if (blocks[status] == blocks[status - 1])
+                    _exit(1);
+            _exit(0);
+        }
+        if (waitpid(pid, &status, 0) < 0)
+            unix_error("waitpid failed in eval_mm_edges");
+        if (!(WIFEXITED(status) && WEXITSTATUS(status) == 0) &&
+            !(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT)) {
+            sprintf(msg, "a %zu-byte block freed by mm_free, then by mm_free_batch, "
+                    "was handed out twice", cached[i]);
+            edge_error(msg);
+        }
+    }
+}
+
+/*
+ * eval_mm_stream - Replay the trace file filename with the mm package
+ *    without loading it (-s). A reader thread fills one buffer of ops
+ *    while this one replays the other, and the blocks live so far are
+ *    found by id in a hash, so that the driver's memory is bounded by
+ *    the live blocks rather than by the length of the trace. Reports
+ *    the throughput and the utilization; -f checks correctness.
+ */
+static void eval_mm_stream(char *filename)
+{
+    stream_t stream;
+    pthread_t reader;
+    chunk_t chunk;
+    livemap_t live = {NULL, 0, 0};
+    tracehdr_t hdr;
+    struct stat st;
+    double secs = 0;
+    long ops = 0;
+    int k;
+
+    /* Open the trace and read its header, text or binary */
+    stream.path = filename;
+    if ((stream.tracefile = fopen(filename, "r")) == NULL) {
+        sprintf(msg, "Could not open %.*s in eval_mm_stream", MAXLINE - 64, filename);
+        unix_error(msg);
+    }
+    stream.binary = fread(&hdr, sizeof(hdr), 1, stream.tracefile) == 1 &&
+        memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) == 0;
+    if (stream.binary && hdr.op_size != (int)sizeof(traceop_t)) {
+        printf("Binary tracefile %s is from another build of mdriver\n", filename);
+        exit(1);
+    }
+    if (!stream.binary) {
+        rewind(stream.tracefile);
+        if (fscanf(stream.tracefile, "%d %d %d %d", &hdr.sugg_heapsize, &hdr.num_ids,
+                   &hdr.num_ops, &hdr.weight) != 4)
+            app_error("Bad tracefile header in eval_mm_stream");
+    }
+    /* a binary file must hold whole records, unless it is a pipe */
+    if (hdr.num_ops < 0 || hdr.num_ids < 0 ||
+        (stream.binary && fstat(fileno(stream.tracefile), &st) == 0 && S_ISREG(st.st_mode) &&
+         (size_t)st.st_size != sizeof(tracehdr_t) + (size_t)hdr.num_ops * sizeof(traceop_t))) {
+        printf("Tracefile %s is truncated or its header is wrong\n", filename);
+        exit(1);
+    }
+    stream.num_ids = hdr.num_ids;
+    stream.num_ops = hdr.num_ops;
+    stream.read = 0;
+    for (k = 0; k < 2; k++) {
+        if ((stream.bufs[k] = (traceop_t *)malloc(STREAM_CHUNK * sizeof(traceop_t))) == NULL)
+            unix_error("malloc failed in eval_mm_stream");
+        stream.full[k] = 0;
+    }
+    pthread_mutex_init(&stream.lock, NULL);
+    pthread_cond_init(&stream.cond, NULL);
+    if (pthread_create(&reader, NULL, stream_reader, &stream) != 0)
+        unix_error("pthread_create failed in eval_mm_stream");
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("mm_init failed in eval_mm_stream");
+
+    chunk.live = &live;
+    chunk.batch = NULL;
+    chunk.batch_size = 0;
+    chunk.total_size = chunk.max_total_size = 0;
+    chunk.max_live = 0;
+    for (k = 0; ; k ^= 1) {
+        pthread_mutex_lock(&stream.lock);
+        while (!stream.full[k])
+            pthread_cond_wait(&stream.cond, &stream.lock);
+        pthread_mutex_unlock(&stream.lock);
+        if (stream.lens[k] == 0)
+            break;
+
+        chunk.ops = stream.bufs[k];
+        chunk.num_ops = stream.lens[k];
+        secs += ftimer_gettod(stream_replay, &chunk, 1);
+        ops += chunk.num_ops;
+
+        pthread_mutex_lock(&stream.lock);
+        stream.full[k] = 0;
+        pthread_cond_signal(&stream.cond);
+        pthread_mutex_unlock(&stream.lock);
+    }
+    pthread_join(reader, NULL);
+    fclose(stream.tracefile);
+
+    printf("\nStreamed %s:\n", filename);
+    printf("%ld ops in %.6f secs (%.0f Kops), util %.0f%%, peak %zu live blocks\n",
+           ops, secs, (secs > 0) ? ops / secs / 1e3 : 0,
+           100 * chunk.max_total_size / (double)mem_heapsize_peak(), chunk.max_live);
+    printf("Driver memory: %zu bytes of op buffers, %zu of live block map\n",
+           2 * STREAM_CHUNK * sizeof(traceop_t), live.nslots * sizeof(live_t));
+
+    for (k = 0; k < 2; k++)
+        free(stream.bufs[k]);
+    free(live.slots);
+    free(chunk.batch);
+}
+
+/*
+ * stream_reader - Fill the two buffers of a stream in turn, each once
+ *    the replay is done with it. A buffer of no ops ends the trace.
+ */
+static void *stream_reader(void *ptr)
+{
+    stream_t *stream = (stream_t *)ptr;
+    int i, k, n;
+
+    for (k = 0; ; k ^= 1) {
+        pthread_mutex_lock(&stream->lock);
+        while (stream->full[k])
+            pthread_cond_wait(&stream->cond, &stream->lock);
+        pthread_mutex_unlock(&stream->lock);
+
+        if (stream->binary)
+            n = fread(stream->bufs[k], sizeof(traceop_t), STREAM_CHUNK, stream->tracefile);
+        else
+            for (n = 0; n < STREAM_CHUNK && read_op(stream->tracefile, &stream->bufs[k][n],
+                                                    stream->path); n++)
+                ;
+
+        /* check the ops as they come, and at the end that they all came */
+        for (i = 0; i < n; i++) {
+            if (!op_ok(&stream->bufs[k][i], stream->num_ids)) {
+                printf("Bogus op %ld in tracefile %s\n", stream->read + i, stream->path);
+                exit(1);
+            }
+        }
+        stream->read += n;
+        if (n == 0 && stream->read != stream->num_ops) {
+            printf("Tracefile %s has %ld ops, but its header says %d\n",
+                   stream->path, stream->read, stream->num_ops);
+            exit(1);
+        }
+
+        pthread_mutex_lock(&stream->lock);
+        stream->lens[k] = n;
+        stream->full[k] = 1;
+        pthread_cond_signal(&stream->cond);
+        pthread_mutex_unlock(&stream->lock);
+        if (n == 0)
+            return NULL;
+    }
+}
+
+/*
+ * stream_replay - Interpret one buffer of requests with the mm package,
+ *    as mm_replay does, keeping the block pointers in the live map.
+ *    Timed by eval_mm_stream.
+ */
+static void stream_replay(void *ptr)
+{
+    chunk_t *chunk = (chunk_t *)ptr;
+    livemap_t *live = chunk->live;
+    traceop_t *op;
+    live_t *b;
+    char *p;
+    int i, k, n, size;
+
+    for (i = 0; i < chunk->num_ops; i++) {
+        op = &chunk->ops[i];
+        switch (op->type) {
+
+        case ALLOC: /* mm_malloc */
+            if ((p = mm_malloc(op->size)) == NULL)
+                app_error("mm_malloc error in stream_replay");
+            live_add(live, op->index, p, op->size);
+            chunk->total_size += op->size;
+            break;
+
+        case REALLOC: /* mm_realloc */
+            b = live_find(live, op->index);
+            if (b->p == NULL) {
+                if ((p = mm_malloc(op->size)) == NULL)
+                    app_error("mm_realloc error in stream_replay");
+                live_add(live, op->index, p, op->size);
+            } else {
+                if ((b->p = mm_realloc(b->p, op->size)) == NULL)
+                    app_error("mm_realloc error in stream_replay");
+                chunk->total_size -= b->size;
+                b->size = op->size;
+            }
+            chunk->total_size += op->size;
+            break;
+
+        case FREE: /* mm_free */
+            if ((p = live_remove(live, op->index, &size)) != NULL) {
+                mm_free(p);
+                chunk->total_size -= size;
+            }
+            break;
+
+        case MEMALIGN: /* mm_memalign */
+            if ((p = mm_memalign(op->align, op->size)) == NULL)
+                app_error("mm_memalign error in stream_replay");
+            live_add(live, op->index, p, op->size);
+            chunk->total_size += op->size;
+            break;
+
+        case CALLOC: /* mm_calloc */
+            if ((p = mm_calloc(1, op->size)) == NULL)
+                app_error("mm_calloc error in stream_replay");
+            live_add(live, op->index, p, op->size);
+            chunk->total_size += op->size;
+            break;
+
+        case ALLOC_BATCH: /* mm_malloc_batch */
+        case FREE_BATCH:  /* mm_free_batch */
+            if (op->count > chunk->batch_size) {
+                chunk->batch_size = op->count;
+                if ((chunk->batch = (void **)realloc(chunk->batch,
+                                                     op->count * sizeof(void *))) == NULL)
+                    unix_error("realloc failed in stream_replay");
+            }
+            if (op->type == ALLOC_BATCH) {
+                if (mm_malloc_batch(op->size, op->count, chunk->batch) < (size_t)op->count)
+                    app_error("mm_malloc_batch error in stream_replay");
+                for (k = 0; k < op->count; k++)
+                    live_add(live, op->index + k, chunk->batch[k], op->size);
+                chunk->total_size += (long)op->count * op->size;
+            } else {
+                for (k = n = 0; k < op->count; k++)
+                    if ((p = live_remove(live, op->index + k, &size)) != NULL) {
+                        chunk->batch[n++] = p;
+                        chunk->total_size -= size;
+                    }
+                mm_free_batch(chunk->batch, n);
+            }
+            break;
+
+        default:
+            app_error("Nonexistent request type in stream_replay");
+        }
+        if (chunk->total_size > chunk->max_total_size)
+            chunk->max_total_size = chunk->total_size;
+        if (live->count > chunk->max_live)
+            chunk->max_live = live->count;
+    }
+}
+
+/*
+ * live_find - the slot of the live block id, or the empty slot where
+ *    it would go
+ */
+static live_t *live_find(livemap_t *live, int id)
+{
+    size_t mask = live->nslots - 1;
+    size_t i = ((size_t)id * 0x9e3779b97f4a7c15UL >> 32) & mask;
+
+    while (live->slots[i].p != NULL && live->slots[i].id != id)
+        i = (i + 1) & mask;
+    return &live->slots[i];
+}
+
+/*
+ * live_add - remember that block id is live at p with size bytes,
+ *    growing the map to keep it at most half full
+ */
+static void live_add(livemap_t *live, int id, char *p, int size)
+{
+    live_t *old = live->slots;
+    size_t i, oldslots = live->nslots;
+    live_t *b;
+
+    if (2 * (live->count + 1) > live->nslots) {
+        live->nslots = oldslots ? 2 * oldslots : 1024;
+        if ((live->slots = (live_t *)calloc(live->nslots, sizeof(live_t))) == NULL)
+            unix_error("calloc failed in live_add");
+        for (i = 0; i < oldslots; i++)
+            if (old[i].p != NULL)
+                *live_find(live, old[i].id) = old[i];
+        free(old);
+    }
+    b = live_find(live, id);
+    if (b->p == NULL)
+        live->count++;
+    b->p = p;
+    b->id = id;
+    b->size = size;
+}
+
+/*
+ * live_remove - forget live block id, returning its pointer (NULL if
+ *    it was not live) and its size in *size
+ */
+static char *live_remove(livemap_t *live, int id, int *size)
+{
+    size_t mask = live->nslots - 1;
+    size_t i, j, k;
+    live_t *b;
+    char *p;
+
+    if (live->count == 0 || (b = live_find(live, id))->p == NULL)
+        return NULL;
+    p = b->p;
+    *size = b->size;
+    live->count--;
+
+    /* Empty its slot, shifting back the blocks that probed past it */
+    i = b - live->slots;
+    live->slots[i].p = NULL;
+    for (j = (i + 1) & mask; live->slots[j].p != NULL; j = (j + 1) & mask) {
+        k = ((size_t)live->slots[j].id * 0x9e3779b97f4a7c15UL >> 32) & mask;
+        if (((j - k) & mask) >= ((j - i) & mask)) {
+            live->slots[i] = live->slots[j];
+            live->slots[j].p = NULL;
+            i = j;
+        }
+    }
+    return p;
+}
+
+/*
+ * eval_libc_valid - We run this function to make sure that the
+ *    libc malloc can run to completion on the set of traces.
+ *    We'll be conservative and terminate if any libc malloc call fails.
+ *
+ */
+static int eval_libc_valid(trace_t *trace, int tracenum)
+{
+    int i, k, newsize;
+    char *p, *newp, *oldp;
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* malloc */
+            if ((p = malloc(trace->ops[i].size)) == NULL) {
+                malloc_error(tracenum, i, "libc malloc failed");
+                unix_error("System message");
+            }
             trace->blocks[trace->ops[i].index] = p;
             break;
 
@@ -862,6 +2360,38 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
             free(trace->blocks[trace->ops[i].index]);
             break;
 
+        case CALLOC: /* calloc */
+            if ((p = calloc(1, trace->ops[i].size)) == NULL) {
+                malloc_error(tracenum, i, "libc calloc failed");
+                unix_error("System message");
+            }
+            trace->blocks[trace->ops[i].index] = p;
+            break;
+
+        case MEMALIGN: /* posix_memalign */
+            if (posix_memalign((void **)&p, LIBC_ALIGN(trace->ops[i].align),
+                               trace->ops[i].size) != 0) {
+                malloc_error(tracenum, i, "libc posix_memalign failed");
+                unix_error("System message");
+            }
+            trace->blocks[trace->ops[i].index] = p;
+            break;
+
+        case ALLOC_BATCH: /* one malloc per block */
+            for (k = 0; k < trace->ops[i].count; k++) {
+                if ((p = malloc(trace->ops[i].size)) == NULL) {
+                    malloc_error(tracenum, i, "libc malloc failed");
+                    unix_error("System message");
+                }
+                trace->blocks[trace->ops[i].index + k] = p;
+            }
+            break;
+
+        case FREE_BATCH: /* one free per block */
+            for (k = 0; k < trace->ops[i].count; k++)
+                free(trace->blocks[trace->ops[i].index + k]);
+            break;
+
         default:
             app_error("invalid operation type  in eval_libc_valid");
         }
@@ -877,7 +2407,7 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
  */
 static void eval_libc_speed(void *ptr)
 {
-    int i;
+    int i, k;
     int index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
@@ -907,6 +2437,32 @@ static void eval_libc_speed(void *ptr)
             block = trace->blocks[index];
             free(block);
             break;
+
+        case CALLOC: /* calloc */
+            index = trace->ops[i].index;
+            if ((trace->blocks[index] = calloc(1, trace->ops[i].size)) == NULL)
+                unix_error("calloc failed in eval_libc_speed");
+            break;
+
+        case MEMALIGN: /* posix_memalign */
+            index = trace->ops[i].index;
+            if (posix_memalign((void **)&trace->blocks[index], LIBC_ALIGN(trace->ops[i].align),
+                               trace->ops[i].size) != 0)
+                unix_error("posix_memalign failed in eval_libc_speed");
+            break;
+
+        case ALLOC_BATCH: /* one malloc per block */
+            index = trace->ops[i].index;
+            for (k = 0; k < trace->ops[i].count; k++)
+                if ((trace->blocks[index + k] = malloc(trace->ops[i].size)) == NULL)
+                    unix_error("malloc failed in eval_libc_speed");
+            break;
+
+        case FREE_BATCH: /* one free per block */
+            index = trace->ops[i].index;
+            for (k = 0; k < trace->ops[i].count; k++)
+                free(trace->blocks[index + k]);
+            break;
         }
     }
 }
@@ -916,6 +2472,92 @@ static void eval_libc_speed(void *ptr)
  ************************************/
 
 
+/*
+ * cmp_int - qsort comparison function for ints
+ */
+static int cmp_int(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+/*
+ * cmp_ptr - qsort comparison function for pointers
+ */
+static int cmp_ptr(const void *a, const void *b)
+{
+    char *x = *(char * const *)a, *y = *(char * const *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * printlifetimes - prints the lifetimes of each trace's blocks and the
+ *    utilization with lifetime hints, as a whole and per region
+ */
+static void printlifetimes(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%8s%8s%7s%7s%7s%7s\n",
+           "trace", "blocks", "median", "short", "util", "heap", "short");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid) {
+            printf("%2d%11s%8s%7s%7s%7s%7s\n", i, "-", "-", "-", "-", "-", "-");
+            continue;
+        }
+        printf("%2d%11d%8d%6.0f%%%6.0f%%%6.0f%%",
+               i,
+               stats[i].blocks,
+               stats[i].median_life,
+               stats[i].short_frac*100.0,
+               stats[i].hint_util*100.0,
+               stats[i].region_util[MM_HINT_NONE]*100.0);
+        if (stats[i].region_util[MM_HINT_SHORT] > 0)
+            printf("%6.0f%%\n", stats[i].region_util[MM_HINT_SHORT]*100.0);
+        else
+            printf("%7s\n", "-");
+    }
+}
+
+/*
+ * printheapstats - prints the free blocks and fragmentation of each
+ *    trace's heap, and with -V the free block histogram
+ */
+static void printheapstats(int n, stats_t *stats)
+{
+    int i, k;
+    mm_stats_t *h;
+
+    printf("%5s%8s%9s%9s%6s%8s%8s%8s%9s\n",
+           "trace", "free", "freeKB", "largeKB", "frag", "quickKB",
+           "splits", "merges", "peakKB");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid) {
+            printf("%2d%11s%9s%9s%6s%8s%8s%8s%9s\n",
+                   i, "-", "-", "-", "-", "-", "-", "-", "-");
+            continue;
+        }
+        h = &stats[i].heap;
+        printf("%2d%11lu%9.1f%9.1f%5.0f%%%8.1f%8lu%8lu%9.1f\n",
+               i,
+               (unsigned long)h->free_blocks,
+               h->free_bytes/1024.0,
+               h->largest_free/1024.0,
+               h->fragmentation*100.0,
+               h->quick_bytes/1024.0,
+               h->splits,
+               h->coalesces,
+               h->peak_size/1024.0);
+        if (verbose > 1) {
+            for (k = 0; k < MM_STATS_BUCKETS; k++)
+                if (h->free_hist[k] > 0)
+                    printf("%13s%lu: %lu\n", ">=",
+                           (unsigned long)MM_STATS_MIN << k,
+                           (unsigned long)h->free_hist[k]);
+        }
+    }
+}
+
 /*
  * printresults - prints a performance summary for some malloc package
  */
@@ -973,6 +2615,88 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printmtresults - prints the aggregate throughput of jobs threads that
+ *     each ran every trace (or, partitioned, their share of it)
+ *     concurrently, how fast each of those threads went, and the
+ *     aggregate throughput of 1 to jobs threads
+ */
+static void printmtresults(int n, stats_t *stats, int jobs, int partition)
+{
+    int i, j;
+    double secs, ops, kops, slowest, fastest;
+
+    printf("%5s%10s%10s%8s%9s%9s\n", "trace", "ops", "secs", "Kops", "slowest", "fastest");
+    secs = ops = 0;
+    for (i=0; i < n; i++) {
+        if (stats[i].valid && stats[i].mt_secs[jobs] > 0) {
+            /* threads too quick for the timer to see are left out */
+            slowest = DBL_MAX;
+            fastest = 0;
+            for (j = 0; j < jobs; j++) {
+                if (stats[i].thread_secs[j] <= 0)
+                    continue;
+                kops = stats[i].thread_ops[j] / 1e3 / stats[i].thread_secs[j];
+                slowest = (kops < slowest) ? kops : slowest;
+                fastest = (kops > fastest) ? kops : fastest;
+            }
+            printf("%2d%13.0f%10.6f%8.0f",
+                   i,
+                   stats[i].ops * (partition ? 1 : jobs),
+                   stats[i].mt_secs[jobs],
+                   (stats[i].ops * (partition ? 1 : jobs)/1e3)/stats[i].mt_secs[jobs]);
+            if (fastest > 0)
+                printf("%9.0f%9.0f\n", slowest, fastest);
+            else
+                printf("%9s%9s\n", "-", "-");
+            secs += stats[i].mt_secs[jobs];
+            ops += stats[i].ops * (partition ? 1 : jobs);
+        }
+        else {
+            printf("%2d%13s%10s%8s%9s%9s\n", i, "-", "-", "-", "-", "-");
+        }
+    }
+    if (errors == 0 && secs > 0)
+        printf("%5s%10.0f%10.6f%8.0f\n", "Total", ops, secs, (ops/1e3)/secs);
+    else if (errors == 0)
+        printf("%5s%10s%10s%8s\n", "Total", "-", "-", "-");
+
+    /* Each thread over all the traces */
+    printf("\n%6s%10s%10s%8s\n", "thread", "ops", "secs", "Kops");
+    for (j = 0; j < jobs; j++) {
+        secs = ops = 0;
+        for (i = 0; i < n; i++) {
+            if (stats[i].valid && stats[i].mt_secs[jobs] > 0) {
+                secs += stats[i].thread_secs[j];
+                ops += stats[i].thread_ops[j];
+            }
+        }
+        if (secs > 0)
+            printf("%3d%13.0f%10.6f%8.0f\n", j, ops, secs, (ops/1e3)/secs);
+        else
+            printf("%3d%13s%10s%8s\n", j, "-", "-", "-");
+    }
+
+    /* The scalability curve */
+    printf("\n%7s%8s%9s\n", "threads", "Kops", "speedup");
+    for (j = 1; j <= jobs; j++) {
+        secs = ops = 0;
+        for (i = 0; i < n; i++) {
+            if (stats[i].valid && stats[i].mt_secs[j] > 0) {
+                secs += stats[i].mt_secs[j];
+                ops += stats[i].ops * (partition ? 1 : j);
+            }
+        }
+        if (secs == 0) {
+            printf("%4d%11s%9s\n", j, "-", "-");
+            continue;
+        }
+        if (j == 1)
+            kops = (ops/1e3)/secs;
+        printf("%4d%11.0f%8.2fx\n", j, (ops/1e3)/secs, (ops/1e3)/secs/kops);
+    }
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -1000,19 +2724,40 @@ void malloc_error(int tracenum, int opnum, char *msg)
     printf("ERROR [trace %d, line %d]: %s\n", tracenum, LINENUM(opnum), msg);
 }
 
+/*
+ * edge_error - Report an edge case the mm_malloc package got wrong
+ */
+void edge_error(char *msg)
+{
+    errors++;
+    printf("ERROR [edge cases]: %s\n", msg);
+}
+
 /* 
  * usage - Explain the command line arguments
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValpL] [-c <level>] [-f <file>] [-t <dir>] [-j <n>] [-P <bytes>]\n");
+    fprintf(stderr, "       mdriver -f <file> -w <binfile>\n");
+    fprintf(stderr, "       mdriver -s <file>\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-c <level> Check the heap after every op: 1 touched blocks,\n");
+    fprintf(stderr, "\t           2 free lists, 3 everything.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-j <n>     Also replay each trace from 1 to n threads at once.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L         Report block lifetimes, and replay with lifetime hints.\n");
+    fprintf(stderr, "\t-p         With -j, split each trace among the threads.\n");
+    fprintf(stderr, "\t-P <bytes> Profile the heap, sampling about once every <bytes>.\n");
+    fprintf(stderr, "\t-s <file>  Replay only <file>, reading it as it goes, and report\n");
+    fprintf(stderr, "\t           its throughput and utilization.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t-w <file>  Convert the -f trace to a binary trace <file> and exit.\n");
+    fprintf(stderr, "\t           Binary traces are mapped instead of parsed.\n");
 }
@@ -2,6 +2,20 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ *            The heap is a MAX_HEAP byte range of address space reserved
+ *            with mmap but left inaccessible. Pages are committed (made
+ *            readable and writable) as the brk pointer moves up past them,
+ *            and handed back to the OS with madvise when mem_sbrk moves
+ *            it back down.
+ *
+ *            Pages the brk has never reached are still the zero pages
+ *            mmap gave us, and mem_zero_lo says where they start, so
+ *            the package can skip clearing them.
+ *
+ *            Besides the heap, the package can map regions of its own
+ *            with mem_map for objects too big to be worth keeping in the
+ *            heap. They count towards the peak footprint of the package.
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,28 +24,62 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "memlib.h"
 #include "config.h"
 
+#define COMMIT_UNIT (1<<16)  /* bytes committed at a time as the heap grows */
+
+/* how pages above a shrunk brk are handed back to the OS */
+#ifdef MADV_FREE
+#define MEM_RELEASE MADV_FREE
+#else
+#define MEM_RELEASE MADV_DONTNEED
+#endif
+
 /* private variables */
 static char *mem_start_brk;  /* points to first byte of heap */
 static char *mem_brk;        /* points to last byte of heap */
 static char *mem_max_addr;   /* largest legal heap address */ 
+static char *mem_commit;     /* end of the committed part of the heap */
+static char *mem_zero;       /* heap bytes from here up have never been handed out */
+static size_t mem_mapped;    /* bytes in mapped regions */
+static size_t mem_peak;      /* largest heap plus mapped bytes since the last reset */
+
+/* a region mapped with mem_map */
+typedef struct region {
+    char *lo;                /* first byte of the region */
+    size_t size;             /* bytes in the region */
+    struct region *next;
+} region_t;
+
+static region_t *mem_regions;   /* regions that are still mapped */
+/* protects the region list, mem_mapped and mem_peak */
+static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void update_peak(void);
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	   fprintf(stderr, "mem_init_vm: malloc error\n");
+    /* reserve the address space we will use to model the available VM */
+    mem_start_brk = (char *)mmap(NULL, MAX_HEAP, PROT_NONE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem_start_brk == MAP_FAILED) {
+	   fprintf(stderr, "mem_init_vm: mmap error\n");
 	   exit(1);
     }
 
     mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
     mem_brk = mem_start_brk;                  /* heap is empty initially */
+    mem_commit = mem_start_brk;               /* and nothing is committed */
+    mem_zero = mem_start_brk;                 /* or written */
+    mem_regions = NULL;
+    mem_mapped = 0;
+    mem_peak = 0;
 }
 
 /* 
@@ -39,35 +87,162 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    mem_reset_brk();
+    munmap(mem_start_brk, MAX_HEAP);
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap,
+ *    and unmap any region the package left mapped
  */
 void mem_reset_brk()
 {
+    region_t *r;
+
+    while ((r = mem_regions) != NULL) {
+        mem_regions = r->next;
+        munmap(r->lo, r->size);
+        free(r);
+    }
+    mem_mapped = 0;
     mem_brk = mem_start_brk;
+    mem_peak = 0;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area.
+ *    A negative incr shrinks the heap, and the whole pages above the
+ *    new brk are returned to the OS.
  */
 void *mem_sbrk(int incr) 
 {
     char *old_brk = mem_brk;
+    char *new_brk = mem_brk + incr;
+    size_t pagesize = mem_pagesize();
+    char *end;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    if ((new_brk < mem_start_brk) || (new_brk > mem_max_addr)) {
 	   errno = ENOMEM;
 	   fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	   return (void *)-1;
     }
-    mem_brk += incr;
+
+    if (new_brk > mem_commit) {
+        /* commit a whole unit at a time so small increments stay cheap */
+        end = mem_start_brk + ((new_brk - mem_start_brk + COMMIT_UNIT - 1) & ~(size_t)(COMMIT_UNIT - 1));
+        if (end > mem_max_addr)
+            end = mem_max_addr;
+        if (mprotect(mem_commit, end - mem_commit, PROT_READ | PROT_WRITE) < 0) {
+            fprintf(stderr, "ERROR: mem_sbrk failed. Could not commit memory...\n");
+            return (void *)-1;
+        }
+        mem_commit = end;
+    }
+    else if (incr < 0) {
+        /* give back every page that no longer holds any of the heap. They
+           stay mapped, so if the OS has not reclaimed them yet by the time
+           the heap grows again, reusing them costs no page faults */
+        end = mem_start_brk + ((new_brk - mem_start_brk + pagesize - 1) & ~(pagesize - 1));
+        if (end < mem_commit) {
+            madvise(end, mem_commit - end, MEM_RELEASE);
+            mem_commit = end;
+        }
+    }
+
+    mem_brk = new_brk;
+    if (new_brk > mem_zero)
+        mem_zero = new_brk;
+    pthread_mutex_lock(&mem_lock);
+    update_peak();
+    pthread_mutex_unlock(&mem_lock);
     return (void *)old_brk;
 }
 
+/*
+ * mem_map - maps a region of size bytes (rounded up to whole pages) apart
+ *    from the heap and returns its start address, or NULL on failure.
+ *    Safe to call from several threads at once.
+ */
+void *mem_map(size_t size)
+{
+    size_t pagesize = mem_pagesize();
+    region_t *r;
+    char *lo;
+
+    size = (size + pagesize - 1) & ~(pagesize - 1);
+    if ((r = (region_t *)malloc(sizeof(region_t))) == NULL)
+        return NULL;
+    lo = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (lo == MAP_FAILED) {
+        free(r);
+        return NULL;
+    }
+
+    r->lo = lo;
+    r->size = size;
+    pthread_mutex_lock(&mem_lock);
+    r->next = mem_regions;
+    mem_regions = r;
+    mem_mapped += size;
+    update_peak();
+    pthread_mutex_unlock(&mem_lock);
+    return lo;
+}
+
+/*
+ * mem_unmap - unmaps the region starting at lo that mem_map returned
+ */
+void mem_unmap(void *lo)
+{
+    region_t **rp, *r;
+
+    pthread_mutex_lock(&mem_lock);
+    for (rp = &mem_regions; (r = *rp) != NULL; rp = &r->next) {
+        if (r->lo == (char *)lo) {
+            *rp = r->next;
+            mem_mapped -= r->size;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mem_lock);
+
+    if (r == NULL) {
+        fprintf(stderr, "ERROR: mem_unmap failed. %p is not a mapped region...\n", lo);
+        return;
+    }
+    munmap(r->lo, r->size);
+    free(r);
+}
+
+/*
+ * mem_in_region - returns whether the bytes lo..hi all lie in one
+ *    mapped region
+ */
+int mem_in_region(void *lo, void *hi)
+{
+    region_t *r;
+    int found = 0;
+
+    pthread_mutex_lock(&mem_lock);
+    for (r = mem_regions; r != NULL && !found; r = r->next)
+        found = (char *)lo >= r->lo && (char *)hi < r->lo + r->size;
+    pthread_mutex_unlock(&mem_lock);
+    return found;
+}
+
+/*
+ * update_peak - raises mem_peak to the current heap plus mapped bytes
+ *    (caller holds mem_lock)
+ */
+static void update_peak(void)
+{
+    size_t total = (size_t)(mem_brk - mem_start_brk) + mem_mapped;
+
+    if (total > mem_peak)
+        mem_peak = total;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -84,6 +259,16 @@ void *mem_heap_hi()
     return (void *)(mem_brk - 1);
 }
 
+/*
+ * mem_zero_lo - return the address from which every heap byte is still
+ *    zero, because the brk has never been above it. Resetting the brk
+ *    does not lower it: the pages below keep whatever was written there.
+ */
+void *mem_zero_lo()
+{
+    return (void *)mem_zero;
+}
+
 /*
  * mem_heapsize() - returns the heap size in bytes
  */
@@ -92,6 +277,28 @@ size_t mem_heapsize()
     return (size_t)(mem_brk - mem_start_brk);
 }
 
+/*
+ * mem_mapsize() - returns the bytes in regions mapped with mem_map
+ */
+size_t mem_mapsize()
+{
+    size_t size;
+
+    pthread_mutex_lock(&mem_lock);
+    size = mem_mapped;
+    pthread_mutex_unlock(&mem_lock);
+    return size;
+}
+
+/*
+ * mem_heapsize_peak() - returns the largest the heap and the mapped
+ *    regions have been together, in bytes, since the last mem_reset_brk
+ */
+size_t mem_heapsize_peak()
+{
+    return mem_peak;
+}
+
 /*
  * mem_pagesize() - returns the page size of the system
  */
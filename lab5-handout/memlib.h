@@ -6,6 +6,12 @@ void *mem_sbrk(int incr);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
+void *mem_zero_lo(void);
 size_t mem_heapsize(void);
+size_t mem_heapsize_peak(void);
+size_t mem_mapsize(void);
 size_t mem_pagesize(void);
+void *mem_map(size_t size);
+void mem_unmap(void *lo);
+int mem_in_region(void *lo, void *hi);
 
@@ -1,10 +1,10 @@
 /*  EMPTY BLOCK
  *  -----------------------------------------------*
- *  |HEADER:    block size               |alloc bit|
+ *  |HEADER:    block size     |prev alloc|alloc bit|
  *  |----------------------------------------------|
- *  | pointer to prev free block in free_listp     |
+ *  | pointer to prev free block in its class list |
  *  |----------------------------------------------|
- *  | pointer to next free block in free_listp     |
+ *  | pointer to next free block in its class list |
  *  |----------------------------------------------|
  *  |FOOTER:    block size               |alloc bit|
  *  ------------------------------------------------
@@ -12,13 +12,11 @@
 
 /*  Allocated BLOCK
  *   -----------------------------------------------*
- *   |HEADER:    block size               |alloc bit|
+ *   |HEADER:    block size     |prev alloc|alloc bit|
  *   |----------------------------------------------|
  *   |               Data                           |
  *   |----------------------------------------------|
  *   |               Data                           |
- *   |----------------------------------------------|
- *   |FOOTER:    block size               |alloc bit|
  *   ------------------------------------------------
  */
 
@@ -29,18 +27,111 @@
  *  Free block
  *  [ HEADER | PREV | NEXT |    PAYLOAD    | FOOTER ]
  *  Allocated block
- *  [ HEADER |   PAYLOAD    | FOOTER ]
+ *  [ HEADER |   PAYLOAD    ]
+ *
+ *  Only free blocks have a footer. Instead, every header keeps a prev-alloc
+ *  bit (bit 1) telling whether the block just before it is allocated, so
+ *  coalesce only reads the previous footer when that block is free.
+ *
+ *  Free blocks smaller than SMALL_LIMIT are kept in segregated free lists,
+ *  one per exact block size (16 bytes apart). Each list is doubly linked
+ *  and LIFO, and class_map has bit i set whenever list i is non-empty.
+ *
+ *  Free blocks of SMALL_LIMIT bytes or more live in a treap ordered by
+ *  (size, address), with the links stored in the block itself:
+ *  [ HEADER | LEFT | RIGHT | PARENT |    PAYLOAD    | FOOTER ]
+ *  A block's priority is a hash of its address, which keeps the tree
+ *  balanced in expectation, so best-fit lookup, insert and remove are all
+ *  O(log n). Ties in size go to the lowest address.
+ *
+ *  The heap itself is shared and protected by heap_lock. In front of it,
+ *  every thread keeps a tcache: one singly linked stack per small block
+ *  size, holding blocks that still look allocated to the heap. Small
+ *  mallocs and frees hit the tcache without locking; an empty bin is
+ *  refilled under one lock with a batch that starts at one block and
+ *  doubles up to TCACHE_BATCH each time the bin runs dry, and a bin that
+ *  grows past TCACHE_LIMIT returns TCACHE_BATCH blocks the same way.
+ *  A thread that exits hands its whole cache back, from the destructor of
+ *  tcache_key.
+ *  The tcache pop is inlined into callers through mm_malloc in mm.h: the
+ *  request size indexes mm_size_bins, a table filled in at compile time
+ *  from SIZE_BIN, and only a miss calls mm_malloc_slow.
+ *
+ *  Requests of at most SLAB_MAX bytes never reach the free lists. They are
+ *  served from slab runs: heap blocks whose payload is one SLAB_RUN-aligned
+ *  page, split into equal objects with no header of their own.
+ *  Slab run (SLAB_RUN bytes, aligned to SLAB_RUN from the heap start)
+ *  [ RUN HEADER (next, prev, class, nfree, free bitmap) | OBJ | OBJ | ... ]
+ *  page_kinds marks which heap pages are runs, which is how mm_free tells a
+ *  slab object from a normal block without reading a header. Runs with at
+ *  least one free object sit on a per-class list. A class only switches to
+ *  slabs after SLAB_ACTIVATE requests, so a program that makes a handful of
+ *  tiny requests does not pay for a whole run.
+ *
+ *  Objects that mm_malloc_hint is told are short-lived (MM_HINT_SHORT) are
+ *  kept apart from everything else, so they do not leave holes between
+ *  long-lived blocks when they die. They are bump allocated from short
+ *  chunks, pages shaped like slab runs:
+ *  [ CHUNK HEADER (bump, live) | SIZE | OBJ | SIZE | OBJ | ... ]
+ *  Freed space in a chunk is not reused. Once every object in a chunk is
+ *  freed, the chunk starts over if it is the one being filled, and is
+ *  given back to the heap otherwise.
+ *
+ *  Frees of blocks smaller than SMALL_LIMIT that reach the shared heap are
+ *  not coalesced right away. The block keeps its allocated header and goes
+ *  on a quick list for its exact size, linked through its first payload
+ *  word, and the next malloc of that size takes it back without touching
+ *  the segregated lists. A quick list longer than QUICK_LIMIT, or a malloc
+ *  that finds no fit, frees and coalesces the waiting blocks in one batch.
+ *
+ *  When a free block at the end of the heap grows past TRIM_THRESHOLD, the
+ *  heap is shrunk back to CHUNKSIZE bytes of free tail and the pages above
+ *  are returned to the OS, so a program gives memory back after a burst.
+ *
+ *  Requests of MMAP_THRESHOLD bytes or more never touch the heap. Each gets
+ *  a region of its own from mem_map, unmapped again when it is freed:
+ *  [ PAD | HEADER (region size, mapped bit 3) |        PAYLOAD        ]
+ *
+ *  mm_malloc_batch carves heap-sized blocks out of one free region, so a
+ *  batch costs one fit and one lock. mm_free_batch sorts the blocks by
+ *  address and gives each run of neighbours back as one block, so the run
+ *  is coalesced once instead of once per block.
+ *
+ *  The heap grows into pages that have never been written, so mm_calloc
+ *  only clears what the allocator itself wrote into a block carved from
+ *  them (see mem_zero_lo in memlib.c).
+ *
+ *  mm_memalign finds a free block big enough to hold the block at an
+ *  aligned address with a whole free block in front of it, the same way
+ *  slab runs are placed, so the skipped space can be allocated again.
+ *
+ *  The heap profiler (mm_prof_start) samples mallocs by bytes allocated:
+ *  every thread counts down in its tcache, and only the malloc that takes
+ *  the count below zero leaves the inline path to record a backtrace.
+ *  Samples are kept in a table hashed by address until the block is freed.
+ *  prof_marks counts the samples per hash of their address, so a free of
+ *  a block that was not sampled costs one load.
+ *
+ *  mm_realloc sets the grown bit (bit 2) of a block it has grown. When such
+ *  a block is resized again it keeps half as much again as was asked for,
+ *  so a block that grows a little at a time is copied only a few times per
+ *  doubling and the small blocks allocated meanwhile land elsewhere.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <execinfo.h>
+#include <sys/random.h>
 
 #include "mm.h"
 #include "memlib.h"
+#include "config.h"
 
 /*********************************************************
  * NOTE: Before you do anything else, please
@@ -63,7 +154,50 @@ team_t team = {
 #define WSIZE       8       /* word size (bytes) */
 #define DSIZE       16      /* doubleword size (bytes) */
 #define CHUNKSIZE  (1<<12)  /* initial heap size (bytes) */
-#define OVERHEAD    16      /* overhead of header and footer (bytes) */
+#ifdef COMPACT
+#define HSIZE       4       /* header and footer size (bytes) */
+#define LSIZE       4       /* free list link size (bytes) */
+#else
+#define HSIZE       WSIZE
+#define LSIZE       WSIZE
+#endif
+#define OVERHEAD    (2*HSIZE)  /* overhead of header and footer of a free block (bytes) */
+#define MIN_BLOCK   (2*LSIZE + OVERHEAD)  /* header, prev, next and footer */
+#define SMALL_LIMIT 512     /* free blocks below this size are on lists, the rest in the tree */
+#define NUM_CLASSES ((SMALL_LIMIT - MIN_BLOCK) / DSIZE)  /* 30 lists (<= 64) */
+#define SLAB_RUN    4096    /* bytes in a slab run, which is also its alignment */
+#define SLAB_HDR    64      /* bytes at the start of a run taken by slab_run_t */
+#define SLAB_MAX    64      /* largest request served from a slab */
+#define SLAB_CLASSES (SLAB_MAX / DSIZE)  /* one object size per 16 bytes */
+#define HEAP_PAGES  (MAX_HEAP / SLAB_RUN)
+#define SLAB_ACTIVATE 32    /* requests of a class before it gets slab runs */
+#define SHORT_HDR   24      /* bytes at the start of a short chunk taken by short_chunk_t */
+#define SHORT_MAX   512     /* largest short-lived request kept in a short chunk */
+#define TCACHE_MIN  80      /* smallest block a request bigger than SLAB_MAX gets */
+#define TCACHE_MAX  256     /* largest block size kept in a thread cache */
+/* one bin per slab class, then one per 16 bytes of block size */
+#define TCACHE_BINS (SLAB_CLASSES + (TCACHE_MAX - TCACHE_MIN) / DSIZE + 1)
+#if TCACHE_BINS != MM_TCACHE_BINS || MM_FAST_MAX > TCACHE_MAX - HSIZE \
+    || (MM_FAST_MAX >> MM_FAST_SHIFT) >= 64
+#error "the thread cache in mm.h does not match mm.c"
+#endif
+/* thread cache bin for a request of s bytes, meaningful up to TCACHE_MAX - HSIZE */
+#define SIZE_BIN(s) ((s) == 0 ? 0 : (s) <= SLAB_MAX ? ((s) - 1) / DSIZE \
+    : SLAB_CLASSES + (DSIZE * (((s) + HSIZE + (DSIZE - 1)) / DSIZE) - TCACHE_MIN) / DSIZE)
+#define TCACHE_BATCH 8      /* blocks moved per refill or flush */
+#define TCACHE_LIMIT 16     /* a bin holding more than this gets flushed */
+#define QUICK_LIMIT 32      /* a quick list holding more than this gets coalesced */
+#define TRIM_THRESHOLD (1<<17)  /* free tail that gets trimmed back to CHUNKSIZE */
+#define MMAP_THRESHOLD (1<<20)  /* requests this big get a mapping of their own */
+#define GROW_SLACK_MAX (1<<20)  /* most slack reserved behind a growing block */
+#define BATCH_SORT 64           /* pointers mm_free_batch sorts at a time */
+#define PROF_DEPTH 16           /* frames kept of a sampled call stack */
+#define PROF_SAMPLES 4096       /* slots for live samples, a power of two */
+#define PROF_STACKS 1024        /* slots for sampled call stacks, a power of two */
+#define PROF_MARKS (1<<14)      /* counters in prof_marks, a power of two */
+#define PROF_IDLE (1<<20)       /* bytes between checks while the profiler is off */
+#define TOUCH_SLOTS 1024        /* slots in touched, a power of two */
+#define TOUCH_MAX 512           /* blocks touched between checks before a full check */
 
 
 /* NOTE: feel free to replace these macros with helper functions and/or
@@ -74,79 +208,376 @@ team_t team = {
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc)  ((size) | (alloc))
 
-#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
-#define ALIGNMENT 8
-
 
-/* Read and write a word at address p */
-#define GET(p)       (*(size_t *)(p))
-#define PUT(p, val)  (*(size_t *)(p) = (val))
+/* Headers, footers and list links are HSIZE byte words */
+#ifdef COMPACT
+typedef unsigned int word_t;
+#if MAX_HEAP > 0xffffffffUL
+#error "COMPACT needs every heap offset to fit in 32 bits"
+#endif
+#else
+typedef size_t word_t;
+#endif
+
+/* Read and write a word at address p. Hardened, the top CSUM_BITS bits of
+ * every header and footer word hold a checksum of the rest of the word and
+ * its address, which CHECK_HDR verifies where a header is trusted. */
+#ifdef HARDENED
+#ifdef COMPACT
+#error "HARDENED needs 8-byte headers, with room for a checksum"
+#endif
+#define CSUM_BITS    16
+#define CSUM_MASK    (~(word_t)0 << (64 - CSUM_BITS))
+#define GET(p)       (*(word_t *)(p) & ~CSUM_MASK)
+#define PUT(p, val)  (put_word(p, val))
+#define HDR_OK(p)    (word_ok(p))
+#define CHECK_HDR(p) do { if (!word_ok(p)) mm_corrupt(p, "bad block header"); } while (0)
+#else
+#define GET(p)       (*(word_t *)(p))
+#define PUT(p, val)  (*(word_t *)(p) = (val))
+#define HDR_OK(p)    true
+#define CHECK_HDR(p) do { } while (0)
+#endif
 
 /* Perform unscaled pointer arithmetic */
 #define PADD(p, val) ((char *)(p) + (val))
 #define PSUB(p, val) ((char *)(p) - (val))
+/* Round p up to a multiple of align, a power of two */
+#define ALIGN_UP(p, align) ((char *)(((size_t)(p) + (align) - 1) & ~((size_t)(align) - 1)))
 
 /* Read the size and allocated fields from address p */
 #define GET_SIZE(p)  (GET(p) & ~0xf)
 #define GET_ALLOC(p) (GET(p) & 0x1)
 
+/* Read, set and clear the prev-alloc bit of the header at address p */
+#define PREV_ALLOC         0x2
+#define GET_PREV_ALLOC(p)  (GET(p) & PREV_ALLOC)
+#define SET_PREV_ALLOC(p)  (PUT(p, GET(p) | PREV_ALLOC))
+#define CLR_PREV_ALLOC(p)  (PUT(p, GET(p) & ~PREV_ALLOC))
+
+/* Read and set the grown bit, kept by allocated blocks that realloc has grown */
+#define GROWN              0x4
+#define GET_GROWN(p)       (GET(p) & GROWN)
+#define SET_GROWN(p)       (PUT(p, GET(p) | GROWN))
+#define CLR_GROWN(p)       (PUT(p, GET(p) & ~GROWN))
+
+/* Read the mapped bit, set in the header of a block that has its own mapping */
+#define MAPPED             0x8
+#define GET_MAPPED(p)      (GET(p) & MAPPED)
+
+/* Write a header at address p, keeping the prev-alloc bit already there */
+#define PUT_HDR(p, val)    (PUT(p, (val) | GET_PREV_ALLOC(p)))
+
 
 /* Given block ptr bp, compute address of its header and footer */
-#define HDRP(bp)       (PSUB(bp, WSIZE))
-#define FTRP(bp)       (PADD(bp, GET_SIZE(HDRP(bp)) - DSIZE))
+#define HDRP(bp)       (PSUB(bp, HSIZE))
+#define FTRP(bp)       (PADD(bp, GET_SIZE(HDRP(bp)) - OVERHEAD))
 
-/* Given block ptr bp, compute address of next and previous blocks */
+/* Given block ptr bp, compute address of next and previous blocks
+ * (PREV_BLKP reads the previous footer, so only use it when that block is free) */
 #define NEXT_BLKP(bp)  (PADD(bp, GET_SIZE(HDRP(bp))))
-#define PREV_BLKP(bp)  (PSUB(bp, GET_SIZE((PSUB(bp, DSIZE)))))
+#define PREV_BLKP(bp)  (PSUB(bp, GET_SIZE((PSUB(bp, OVERHEAD)))))
+
+/* Hide and reveal a link stored in a free block. Hardened, links are XORed
+ * with mm_link_secret, and reveal checks that they point into the heap. */
+#ifdef HARDENED
+#define HIDE(p)      ((void *)((size_t)(p) ^ mm_link_secret))
+#define REVEAL(p)    (reveal(p))
+#else
+#define HIDE(p)      (p)
+#define REVEAL(p)    (p)
+#endif
+
+/* Read and write a free list link at address p. In compact mode a link is
+ * the offset of the block from the start of the heap, with 0 for NULL. */
+#ifdef COMPACT
+#define GET_LINK(p)       (GET(p) ? (void *)PADD(heap_lo, GET(p)) : NULL)
+#define PUT_LINK(p, val)  (PUT(p, (val) ? HEAP_OFF(val) : 0))
+#else
+#define GET_LINK(p)       (REVEAL(*(void **)(p)))
+#define PUT_LINK(p, val)  (*(void **)(p) = HIDE(val))
+#endif
 
 /* Get the next free block given pointer */
-#define PREV_FREE_BLKP(bp)  (*(void **)(GET_P(bp)))
-#define NEXT_FREE_BLKP(bp)  (*(void **) (GET_P((PADD(bp, WSIZE)))))
-
-#define GET_P(p) ((void **)(p))
-#define PUT_P(p, val)  (*(void **)(p) = (val))
+#define PREV_FREE_BLKP(bp)  (GET_LINK(bp))
+#define NEXT_FREE_BLKP(bp)  (GET_LINK(PADD(bp, LSIZE)))
+
+/* Links of a free block in the large block tree */
+#define TREE_LEFT(bp)    (REVEAL(*(void **)(bp)))
+#define TREE_RIGHT(bp)   (REVEAL(*(void **)PADD(bp, WSIZE)))
+#define TREE_PARENT(bp)  (REVEAL(*(void **)PADD(bp, 2*WSIZE)))
+#define SET_LEFT(bp, p)    (*(void **)(bp) = HIDE(p))
+#define SET_RIGHT(bp, p)   (*(void **)PADD(bp, WSIZE) = HIDE(p))
+#define SET_PARENT(bp, p)  (*(void **)PADD(bp, 2*WSIZE) = HIDE(p))
+
+/* Link of a block on a thread cache or quick list stack to the next one.
+ * Hardened, such a block also holds free_key in its second word. */
+#define STACK_NEXT(bp)       MM_STACK_NEXT(bp)
+#define SET_STACK_NEXT(bp, p)  (*(void **)(bp) = HIDE(p))
+#ifdef HARDENED
+#define MARK_CACHED(bp)      (((void **)(bp))[1] = free_key)
+#define IS_CACHED(bp)        (((void **)(bp))[1] == free_key)
+#else
+#define MARK_CACHED(bp)
+#define IS_CACHED(bp)        false
+#endif
+#define UNMARK_CACHED(bp)    MM_UNMARK(bp)
+
+/* What a free of a block that is already free does */
+#ifdef HARDENED
+#define DOUBLE_FREE(bp)      mm_corrupt(bp, "double free")
+#else
+#define DOUBLE_FREE(bp)      printf("The block is already free!")
+#endif
+
+/* Offset of p from the start of the heap, the page holding it, and the
+ * slab run or short chunk starting that page */
+#define HEAP_OFF(p)    ((size_t)((char *)(p) - (char *)heap_lo))
+#define HEAP_PAGE(p)   (HEAP_OFF(p) / SLAB_RUN)
+#define SLAB_RUNP(p)   ((slab_run_t *)PSUB(p, HEAP_OFF(p) % SLAB_RUN))
+#define SHORT_CHUNKP(p) ((short_chunk_t *)PSUB(p, HEAP_OFF(p) % SLAB_RUN))
+
+/* What a heap page is used for, in page_kinds */
+#define PAGE_HEAP   0       /* ordinary blocks */
+#define PAGE_SLAB   1       /* a slab run */
+#define PAGE_SHORT  2       /* a short chunk */
+
+/* Header at the start of every slab run, see the top of the file */
+typedef struct slab_run {
+    struct slab_run *next;        /* next run of this class with free objects */
+    struct slab_run *prev;        /* previous run of this class with free objects */
+    unsigned int class;           /* object size is (class + 1) * DSIZE */
+    unsigned int nfree;           /* number of free objects */
+    unsigned long bitmap[4];      /* bit i is set when object i is free */
+} slab_run_t;
+
+/* Header at the start of every short chunk, see the top of the file */
+typedef struct {
+    char *bump;                   /* where the next object's size word goes */
+    unsigned int live;            /* number of objects not yet freed */
+} short_chunk_t;
+
+/* A live block sampled by the profiler, see mm_prof_start */
+typedef struct {
+    void *bp;                     /* the block, NULL for an empty slot */
+    size_t bytes;                 /* bytes the sample stands for */
+    int stack;                    /* index of its call stack in prof_stacks */
+} prof_sample_t;
+
+/* A call stack some samples were taken at */
+typedef struct {
+    void *frames[PROF_DEPTH];
+    int depth;                    /* frames in use, 0 for an empty slot */
+    size_t live_bytes;            /* bytes the live samples stand for */
+    size_t live_count;            /* number of live samples */
+    size_t total_bytes;           /* the same for every sample since the start */
+    size_t total_count;
+} prof_stack_t;
+
+/* Per-thread cache of small allocated blocks, see the top of the file */
+typedef mm_tcache_t tcache_t;
 
 /* Global variables */
 
 // Pointer to first block
 static void *heap_start = NULL;
-static void *free_listp = NULL;
+// Heads of the segregated free lists, indexed by size class
+static void *seg_lists[NUM_CLASSES];
+// Bit i is set when seg_lists[i] is non-empty
+static unsigned long class_map = 0;
+// Freed small blocks waiting to be coalesced, indexed by size class
+static void *quick_lists[NUM_CLASSES];
+// Number of blocks on each quick list
+static int quick_counts[NUM_CLASSES];
+// Root of the tree of free blocks of at least SMALL_LIMIT bytes
+static void *tree_root = NULL;
+// First byte of the heap, which slab runs are aligned against
+static void *heap_lo = NULL;
+// Runs with free objects, indexed by slab class
+static slab_run_t *slab_runs[SLAB_CLASSES];
+// page_kinds[i] says whether heap page i is a slab run, a short chunk or neither
+static unsigned char page_kinds[HEAP_PAGES];
+// The short chunk being filled
+static short_chunk_t *short_chunk = NULL;
+// Bytes of heap taken by short chunks
+static size_t short_bytes = 0;
+// Requests seen per slab class, up to SLAB_ACTIVATE
+static int slab_requests[SLAB_CLASSES];
+// Blocks split in two and pairs of blocks merged since mm_init, for mm_stats
+static unsigned long split_count = 0;
+static unsigned long coalesce_count = 0;
+// Mean bytes between profiler samples, 0 while the profiler is off
+static size_t prof_interval = 0;
+// State of the generator that spaces the samples out
+static size_t prof_seed = 1;
+// Live samples, hashed by address, and the call stacks they were taken at
+static prof_sample_t prof_samples[PROF_SAMPLES];
+static prof_stack_t prof_stacks[PROF_STACKS];
+static size_t prof_live = 0;
+static size_t prof_nstacks = 0;
+// Samples not kept because a table was full
+static size_t prof_dropped = 0;
+// Live samples per PROF_MARK of their address, which mm_free reads without
+// prof_lock: a block is sampled before its caller ever sees it
+static unsigned short prof_marks[PROF_MARKS];
+// Blocks touched since the last mm_checkheap, hashed by address, and the
+// slots in use. TOUCH_GONE marks a block that became part of another.
+static void *touched[TOUCH_SLOTS];
+static int touch_slots[TOUCH_MAX];
+static int touch_count = 0;
+// Whether touched is kept up to date, and whether it ran out of room
+static bool touch_on = false;
+static bool touch_overflow = false;
+// Protects the profiler state above
+static pthread_mutex_t prof_lock = PTHREAD_MUTEX_INITIALIZER;
+// Protects the heap and the segregated lists above
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+// Key whose destructor hands an exiting thread's cache back to the heap
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+#ifdef HARDENED
+// Secret XORed into free block links, and the key cached blocks hold,
+// both drawn by mm_init
+size_t mm_link_secret = 0;
+static void *free_key = NULL;
+#endif
+// Bumped by mm_init so that thread caches drop blocks of an old heap
+unsigned long mm_heap_epoch = 0;
+// This thread's cache
+__thread tcache_t mm_tcache;
+// SIZE_BIN of every multiple of 1 << MM_FAST_SHIFT, for the inline mm_malloc
+#define FAST_BIN(n) SIZE_BIN((size_t)(n) << MM_FAST_SHIFT)
+#define FAST_BINS4(n) FAST_BIN(n), FAST_BIN(n + 1), FAST_BIN(n + 2), FAST_BIN(n + 3)
+#define FAST_BINS16(n) FAST_BINS4(n), FAST_BINS4(n + 4), FAST_BINS4(n + 8), FAST_BINS4(n + 12)
+const unsigned char mm_size_bins[64] = {
+    FAST_BINS16(0), FAST_BINS16(16), FAST_BINS16(32), FAST_BINS16(48)
+};
+
+/* Profiler counter of a block address, and the check mm_free makes */
+#define PROF_MARK(bp)    (mix((size_t)(bp)) & (PROF_MARKS - 1))
+#define PROF_FORGET(bp)  do { if (prof_marks[PROF_MARK(bp)] != 0) prof_forget(bp); } while (0)
+
+/* Record that a block was written to, or merged into another, for
+ * incremental checks; nothing is recorded until mm_checkheap asks for it */
+#define TOUCH_GONE       ((void *)1)
+#define TOUCH(bp)        do { if (touch_on) touch(bp, true); } while (0)
+#define UNTOUCH(bp)      do { if (touch_on) touch(bp, false); } while (0)
+
+/* Whether p points past the prologue into the heap */
+#define IN_HEAP(p)       ((char *)(p) > (char *)heap_start && (char *)(p) <= (char *)mem_heap_hi())
 
 /* Function prototypes for internal helper routines */
 
-static bool check_heap(int lineno);
+static bool check_heap(int lineno, size_t *nfree);
 static void print_heap();
 static void print_block(void *bp);
 static bool check_block(int lineno, void *bp);
+static bool check_touched(int lineno, void *bp);
+static bool check_free_block(int lineno, void *bp);
+static bool check_free_lists(int lineno, size_t *nfree);
+static bool check_tree(int lineno, void *bp, void *parent, void *lo, void *hi, size_t *nfree);
+static void touch(void *bp, bool add);
+static void touch_reset(void);
 static void *extend_heap(size_t size);
+static void trim_heap(void *bp);
 static void *find_fit(size_t asize);
 static void *coalesce(void *bp);
 static void rmv_from_free(void *bp);
 static void insert_front(void *bp);
+static int size_class(size_t size);
+static bool tree_less(void *a, void *b);
+static size_t tree_prio(void *bp);
+static void tree_replace(void *parent, void *old, void *new);
+static void tree_rotate_up(void *bp);
+static void tree_insert(void *bp);
+static void tree_remove(void *bp);
+static void *tree_best_fit(size_t asize);
+static void print_tree(void *bp);
 static void place(void *bp, size_t asize);
+static void trim_block(void *bp, size_t asize);
+static void *realloc_in_place(void *bp, size_t asize, size_t keep);
+static size_t adjust_size(size_t size);
+static size_t grow_reserve(size_t asize);
+static void *malloc_block(size_t asize);
+static size_t carve_blocks(size_t asize, size_t n, void **out);
+static void free_block(void *bp);
+static bool free_ok(void *bp);
+static bool tcache_holds(tcache_t *tc, void *bp, int kind);
+static void release_block(void *bp);
+static void quick_flush(int class);
+static bool quick_flush_all(void);
+static tcache_t *get_tcache(void);
+static void tcache_key_create(void);
+static void tcache_exit(void *ptr);
+static void tcache_refill(tcache_t *tc, int bin);
+static void *malloc_aligned(size_t asize, size_t align);
+static void *find_aligned_fit(size_t asize, size_t align);
+static void *mmap_block(size_t size);
+static void munmap_block(void *bp);
+static int slab_capacity(int class);
+static int page_kind(void *bp);
+static void *slab_alloc(int class);
+static void slab_free(void *bp);
+static void slab_unlink(slab_run_t *run);
+static void *short_alloc(size_t size);
+static void short_free(void *bp);
+static void tcache_flush(tcache_t *tc, int bin);
 static size_t max(size_t x, size_t y);
+static size_t min(size_t x, size_t y);
+static int cmp_ptr(const void *a, const void *b);
+static size_t mix(size_t x);
+#ifdef HARDENED
+static inline void put_word(void *p, word_t val);
+static inline bool word_ok(void *p);
+static inline void *reveal(void *link);
+#endif
+static void prof_reset(void);
+static long prof_gap(void);
+static int prof_stack(void **frames, int depth);
+static void prof_record(void *bp, size_t size, void **frames, int depth);
+static void prof_forget(void *bp);
+static int cmp_stack(const void *a, const void *b);
 static void print_free_heap();
 
 //Currently a version that works up till trace 6
 
 /*
- * mm_init -- Initializes malloc and free_listp
+ * mm_init -- Initializes malloc and the segregated free lists
+ * Not thread-safe: no other thread may be inside the allocator.
  */
 int mm_init(void) {
-  free_listp = NULL;
+    memset(seg_lists, 0, sizeof(seg_lists));
+    class_map = 0;
+    memset(quick_lists, 0, sizeof(quick_lists));
+    memset(quick_counts, 0, sizeof(quick_counts));
+    tree_root = NULL;
+    memset(slab_runs, 0, sizeof(slab_runs));
+    memset(page_kinds, 0, sizeof(page_kinds));
+    short_chunk = NULL;
+    short_bytes = 0;
+    memset(slab_requests, 0, sizeof(slab_requests));
+    split_count = 0;
+    coalesce_count = 0;
+    prof_reset();
+    touch_on = false;
+    touch_reset();
+    heap_lo = mem_heap_lo();
+    mm_heap_epoch++;
+#ifdef HARDENED
+    if (getrandom(&mm_link_secret, sizeof(mm_link_secret), 0) != sizeof(mm_link_secret))
+        mm_link_secret = mix((size_t)heap_lo ^ mm_heap_epoch);
+    free_key = (void *)mix(mm_link_secret);
+#endif
     /* create the initial empty heap */
-    if ((heap_start = mem_sbrk(4 * WSIZE)) == NULL)
+    if ((heap_start = mem_sbrk(2 * DSIZE)) == NULL)
         return -1;
 
-    //Making a free_list to keep track of all the free blocks
-    //free_listp = heap_start;
-
-    PUT(heap_start, 0);                        /* alignment padding */
-    PUT(PADD(heap_start, 1*WSIZE), PACK(OVERHEAD, 1));  /* prologue header */
-    PUT(PADD(heap_start, 2*WSIZE), PACK(OVERHEAD, 1));  /* prologue footer */
-    PUT(PADD(heap_start, 3*WSIZE), PACK(0, 1));   /* epilogue header */
+    memset(heap_start, 0, DSIZE - HSIZE);      /* alignment padding */
+    heap_start = PADD(heap_start, DSIZE); /* start the heap at the (empty) payload of the prologue block */
 
-    heap_start = PADD(heap_start, DSIZE); /* start the heap at the (size 0) payload of the prologue block */
+    PUT(HDRP(heap_start), PACK(DSIZE, PREV_ALLOC | 1));  /* prologue header */
+    PUT(FTRP(heap_start), PACK(DSIZE, 1));  /* prologue footer */
+    PUT(HDRP(NEXT_BLKP(heap_start)), PACK(0, PREV_ALLOC | 1));   /* epilogue header */
 
     /* Extend the empty heap with a free block of CHUNKSIZE bytes */
     if (extend_heap(CHUNKSIZE / WSIZE) == NULL)
@@ -156,36 +587,45 @@ int mm_init(void) {
 }
 
 /*
- * mm_malloc -- Allocate a block
+ * mm_malloc_slow -- Allocate a block the inline mm_malloc in mm.h could not
+ * Requests up to SLAB_MAX bytes get a slab object and other small requests
+ * a small block, both through this thread's cache. Everything else comes
+ * from the shared heap under heap_lock.
  */
-void *mm_malloc(size_t size) {
+void *mm_malloc_slow(size_t size) {
     size_t asize;      /* adjusted block size */
-    size_t extendsize; /* amount to extend heap if no fit */
     char *bp;
+    int bin;
 
     /* Ignore spurious requests */
     if (size <= 0)
         return NULL;
 
-    /* Adjust block size to include overhead and alignment reqs. */
-    if (size <= DSIZE) {
-        asize = DSIZE + OVERHEAD;
-    } else {
-        /* Add overhead and then round up to nearest multiple of double-word alignment */
-        asize = DSIZE * ((size + (OVERHEAD) + (DSIZE - 1)) / DSIZE);
-    }
-    /* Search the free list for a fit */
-    if ((bp = find_fit(asize)) != NULL) {
-        place(bp, asize);
+    if (size >= MMAP_THRESHOLD)
+        return mmap_block(size);
+
+    asize = adjust_size(size);
+    bin = SIZE_BIN(size);
+
+    /* big requests, and tiny ones whose class has no slabs yet, go to the heap */
+    if (asize > TCACHE_MAX || (bin < SLAB_CLASSES && slab_requests[bin] < SLAB_ACTIVATE)) {
+        pthread_mutex_lock(&heap_lock);
+        if (bin < SLAB_CLASSES)
+            slab_requests[bin]++;
+        bp = malloc_block(asize);
+        pthread_mutex_unlock(&heap_lock);
         return bp;
     }
-    /* No fit found. Get more memory and place the block */
-    // printf("need to get more memory for heap\n");
-    extendsize = max(asize, CHUNKSIZE);
-    if ((bp = extend_heap(extendsize / WSIZE)) == NULL)
-        return NULL;
 
-    place(bp, asize);
+    tcache_t *tc = get_tcache();
+
+    if (tc->bins[bin] == NULL)
+        tcache_refill(tc, bin);
+    if ((bp = tc->bins[bin]) == NULL)
+        return NULL;
+    tc->bins[bin] = STACK_NEXT(bp);
+    tc->counts[bin]--;
+    UNMARK_CACHED(bp);
     return bp;
 }
 
@@ -197,23 +637,53 @@ void *mm_malloc(size_t size) {
  * VOID.
  * Precondition: We can only free alocated blocks.
  * Precondition: Only free blocks within our heap. Don't run past the prologue and epilogue
- * Postcondition: Valid bit becomes 0.
+ * Postcondition: Valid bit becomes 0, or the block sits in this thread's cache.
  */
 void mm_free(void *bp) {
-    char *curHdr = HDRP(bp);
-    char *curFtr = FTRP(bp);
+    size_t blockSize;
+    int bin;
+    int kind = page_kind(bp);
 
-    //check if the current block is allocated
-    if(GET_ALLOC(curHdr) == 0){
-        printf("The block is already free!");
+    PROF_FORGET(bp);
+
+    /* slab objects and short-lived objects have no header, so look at the page first */
+    if (kind == PAGE_SHORT) {
+        pthread_mutex_lock(&heap_lock);
+        short_free(bp);
+        pthread_mutex_unlock(&heap_lock);
         return;
+    } else if (kind == PAGE_SLAB) {
+        bin = SLAB_RUNP(bp)->class;
+    } else {
+        CHECK_HDR(HDRP(bp));
+        if (GET_MAPPED(HDRP(bp))) {
+            munmap_block(bp);
+            return;
+        }
+        blockSize = GET_SIZE(HDRP(bp));
+        if (blockSize < TCACHE_MIN || blockSize > TCACHE_MAX || !GET_ALLOC(HDRP(bp))) {
+            pthread_mutex_lock(&heap_lock);
+            free_block(bp);
+            pthread_mutex_unlock(&heap_lock);
+            return;
+        }
+        bin = SLAB_CLASSES + (blockSize - TCACHE_MIN) / DSIZE;
     }
 
-    size_t blockSize = GET_SIZE(curHdr);
+    tcache_t *tc = get_tcache();
+
+    /* a cached block still looks allocated; without HARDENED's key, only
+     * a second free of the block on top of the bin is caught */
+    if (IS_CACHED(bp) || tc->bins[bin] == bp) {
+        DOUBLE_FREE(bp);
+        return;
+    }
 
-    PUT(curHdr, PACK(blockSize, 0));
-    PUT(curFtr, PACK(blockSize, 0));
-    coalesce(bp);
+    SET_STACK_NEXT(bp, tc->bins[bin]);
+    MARK_CACHED(bp);
+    tc->bins[bin] = bp;
+    if (++tc->counts[bin] > TCACHE_LIMIT)
+        tcache_flush(tc, bin);
 }
 
 /*
@@ -223,11 +693,9 @@ void mm_free(void *bp) {
 void *mm_realloc(void *ptr, size_t size) {
   size_t oldsize;
   size_t newsize;
+  size_t keep;
 	void *newptr;
-
-	//If size is negative it means nothing, just return NULL
-	if((int)size < 0)
-    	return NULL;
+	bool grown, moved = false;
 
 	/* If size == 0 then this is just free, and we return NULL. */
 	if (size == 0) {
@@ -239,317 +707,1889 @@ void *mm_realloc(void *ptr, size_t size) {
 	if (ptr == NULL)
 		return (mm_malloc(size));
 
-	oldsize=GET_SIZE(HDRP(ptr));
-    // newsize after adding header and footer to asked size
-	newsize = size + (2 * WSIZE);
-
-	/* Copy the old data. */
-
-	//If the size needs to be decreased, shrink the block and return the same pointer
-	if (newsize <= oldsize){
-
-	   /*
-		* Shrinks block so cannot preserve data. Just return pointer
-		*/
-
-		return ptr;
-	}else{
-        //check if next block is allocated
-		size_t ifNextAlloc = GET_ALLOC(HDRP(NEXT_BLKP(ptr)));
-        //check if next block is allocated		
-		size_t nextBlkSize = GET_SIZE(HDRP(NEXT_BLKP(ptr)));	
-        //total free size of current and next block	
-		size_t totalFreeSize = oldsize + nextBlkSize;			
-
-		//combining current and next block if totalFreeSize is greater then or equal to new size
-		if(!ifNextAlloc && totalFreeSize>= newsize){
-			rmv_from_free(NEXT_BLKP(ptr));
-			PUT(HDRP(ptr),PACK(totalFreeSize,1));
-			PUT(FTRP(ptr),PACK(totalFreeSize,1));
+	/* the profiler only follows a block until it is resized */
+	PROF_FORGET(ptr);
+
+	/* A slab or short-lived object can only stay put if the new size fits it */
+	if (page_kind(ptr) != PAGE_HEAP) {
+		if (page_kind(ptr) == PAGE_SLAB)
+			oldsize = (SLAB_RUNP(ptr)->class + 1) * DSIZE;
+		else
+			oldsize = GET(PSUB(ptr, WSIZE));
+		if (size <= oldsize)
 			return ptr;
-		}
-		//finding new size elsewhere in free_list and copy old data to new place
-		else{
-			newptr=mm_malloc(newsize);
+		if ((newptr = mm_malloc(size)) == NULL)
+			return NULL;
+		memcpy(newptr, ptr, oldsize);
+		mm_free(ptr);
+		return newptr;
+	}
 
-			/* If realloc() fails the original block is left untouched  */
-			if (newptr == NULL)
-				return (NULL);
+	/* So can a mapped block, as long as the new size still deserves a mapping */
+	CHECK_HDR(HDRP(ptr));
+	if (GET_MAPPED(HDRP(ptr))) {
+		oldsize = GET_SIZE(HDRP(ptr)) - DSIZE;
+		if (size <= oldsize && size >= MMAP_THRESHOLD)
+			return ptr;
+		if ((newptr = mm_malloc(size)) == NULL)
+			return NULL;
+		memcpy(newptr, ptr, min(oldsize, size));
+		mm_free(ptr);
+		return newptr;
+	}
 
-			place(newptr,newsize);
-			memcpy(newptr,ptr,oldsize);
-			mm_free(ptr);
-			return newptr;
+	/* First try to resize without moving, or at least without leaving the
+	 * neighbourhood. A size the heap could never hold can only be mapped,
+	 * and mm_malloc decides whether it can be. */
+	oldsize = GET_SIZE(HDRP(ptr));
+	newptr = NULL;
+	if (size < MAX_HEAP) {
+		newsize = adjust_size(size);
+
+		pthread_mutex_lock(&heap_lock);
+		/* A block grown a second time will probably keep growing, so it gets to
+		 * keep geometric slack behind it and later growth fits without a copy */
+		grown = newsize > oldsize || GET_GROWN(HDRP(ptr));
+		keep = GET_GROWN(HDRP(ptr)) ? grow_reserve(newsize) : newsize;
+		newptr = realloc_in_place(ptr, newsize, keep);
+		if (newptr == NULL && newsize > TCACHE_MAX && size < MMAP_THRESHOLD) {
+			newptr = malloc_block(keep);
+			moved = true;
 		}
+		/* only blocks the tcache never holds carry the bit, since it is set in place */
+		if (newptr != NULL && grown && GET_SIZE(HDRP(newptr)) > TCACHE_MAX)
+			SET_GROWN(HDRP(newptr));
+		pthread_mutex_unlock(&heap_lock);
+		if (newptr != NULL && !moved)
+			return newptr;
 	}
-}
 
+	//finding new size elsewhere in the heap and copy old data to new place
+	if (newptr == NULL)
+		newptr = mm_malloc(size);
 
-/* The remaining routines are internal helper routines */
+	/* If realloc() fails the original block is left untouched  */
+	if (newptr == NULL)
+		return (NULL);
+
+	memcpy(newptr, ptr, oldsize - HSIZE);
+	mm_free(ptr);
+	return newptr;
+}
 
 
 /*
- * place -- Place block of asize bytes at start of free block bp
- *          and <How are you handling splitting?>
- * Takes a pointer to a free block and the size of block to place inside it
- * Returns nothing
- * Precondition: We know that there is room in the list because both times place is called,
- * in malloc, we know that there is room avaliable. Called after find_fit and extend_heap.
- # Precondition: asize is a factor of 16.
- * Postcondition: Placed block has an allocated tag
+ * mm_malloc_hint -- Allocate a block, given a guess of how long it will live
+ * (MM_HINT_NONE or MM_HINT_SHORT)
  */
-static void place(void *bp, size_t asize) {
-    size_t curSize = GET_SIZE(HDRP(bp));
-
-    /* enough space for free block, split */
-    if ((curSize - asize) >= DSIZE+OVERHEAD) {
-        rmv_from_free(bp);
-        PUT(HDRP(bp), PACK(asize, 1));
-        PUT(FTRP(bp), PACK(asize, 1));
+void *mm_malloc_hint(size_t size, int hint) {
+    void *bp;
 
-        char *nextBp = NEXT_BLKP(bp);
-        PUT(HDRP(nextBp), PACK(curSize-asize, 0));
-        PUT(FTRP(nextBp), PACK(curSize-asize, 0));
-        coalesce(nextBp);
-    }
-    /* not enough space for free block, don't split */
-    else {
-        PUT(HDRP(bp), PACK(curSize, 1));
-        PUT(FTRP(bp), PACK(curSize, 1));
-        rmv_from_free(bp);
-    }
+    if (hint != MM_HINT_SHORT || size == 0 || size > SHORT_MAX)
+        return mm_malloc(size);
 
+    pthread_mutex_lock(&heap_lock);
+    bp = short_alloc(size);
+    pthread_mutex_unlock(&heap_lock);
+    return bp;
 }
 
-
-
 /*
- * coalesce -- Boundary tag coalescing.
- * Takes a pointer to a free block
- * Return ptr to coalesced block
- * <Are there any preconditions or postconditions?>
+ * mm_region -- Returns the region an allocated block lives in: MM_HINT_SHORT
+ * for the short chunks, MM_HINT_NONE for the rest of the heap
  */
- static void *coalesce(void *bp)
- {
-     /* get tags of next and previous blocks */
- 	size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp))) || PREV_BLKP(bp) == bp;
- 	size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
-
- 	size_t size = GET_SIZE(HDRP(bp));
-
-
-     /* case 2 */
- 	if (prev_alloc && !next_alloc)
- 	{
- 		size += GET_SIZE(HDRP(NEXT_BLKP(bp)));  /* add size of next free block */
- 		rmv_from_free(NEXT_BLKP(bp));           /* remove the block from free list */
- 		PUT(HDRP(bp), PACK(size, 0));
- 		PUT(FTRP(bp), PACK(size, 0));
- 	}
+int mm_region(void *ptr) {
+    return page_kind(ptr) == PAGE_SHORT ? MM_HINT_SHORT : MM_HINT_NONE;
+}
 
-     /* case 3 */
- 	else if (!prev_alloc && next_alloc)
- 	{
- 	  size += GET_SIZE(HDRP(PREV_BLKP(bp)));    /* add size of previous free block */
- 	  bp = PREV_BLKP(bp);
- 	  rmv_from_free(bp);                         /* remove the block from free list */
- 	  PUT(HDRP(bp), PACK(size, 0));
- 	  PUT(FTRP(bp), PACK(size, 0));
- 	}
+/*
+ * mm_region_size -- Returns how many bytes of heap a region takes up,
+ * counting free space outside the short chunks and mapped blocks towards
+ * MM_HINT_NONE
+ */
+size_t mm_region_size(int region) {
+    size_t bytes;
 
-     /* case 4 Coalesce with both*/
- 	else if (!prev_alloc && !next_alloc)
- 	{
-        /* add size of next and previous free block */
- 		size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(HDRP(NEXT_BLKP(bp)));
- 		rmv_from_free(PREV_BLKP(bp));   /* remove the block from free list */
- 		rmv_from_free(NEXT_BLKP(bp));   /* remove the block from free list */
- 		bp = PREV_BLKP(bp);
- 		PUT(HDRP(bp), PACK(size, 0));
- 		PUT(FTRP(bp), PACK(size, 0));
- 	}else if(prev_alloc && next_alloc){
-    // printf("Coalesce with nothing\n");
-  }
+    pthread_mutex_lock(&heap_lock);
+    bytes = (region == MM_HINT_SHORT) ? short_bytes : mem_heapsize() - short_bytes + mem_mapsize();
+    pthread_mutex_unlock(&heap_lock);
+    return bytes;
+}
 
-    /* if case 1 occurs, it will drop down here without merging with any blocks */
- 	insert_front(bp);
- 	return bp;
+/*
+ * mm_stats -- Fill in stats with a snapshot of the shared heap, see mm.h
+ * Walks every block, so it takes time in proportion to the heap size.
+ */
+void mm_stats(mm_stats_t *stats) {
+    char *bp;
+    size_t size;
+    int class, k;
+
+    memset(stats, 0, sizeof(*stats));
+    pthread_mutex_lock(&heap_lock);
+    for (bp = heap_start; (size = GET_SIZE(HDRP(bp))) > 0; bp = NEXT_BLKP(bp)) {
+        if (GET_ALLOC(HDRP(bp)))
+            continue;
+        stats->free_blocks++;
+        stats->free_bytes += size;
+        stats->largest_free = max(stats->largest_free, size);
+        for (k = 0; k < MM_STATS_BUCKETS - 1 && size >= (size_t)MM_STATS_MIN << (k + 1); k++)
+            ;
+        stats->free_hist[k]++;
+    }
+    for (class = 0; class < NUM_CLASSES; class++)
+        for (bp = quick_lists[class]; bp != NULL; bp = STACK_NEXT(bp))
+            stats->quick_bytes += GET_SIZE(HDRP(bp));
+    stats->heap_size = mem_heapsize();
+    stats->splits = split_count;
+    stats->coalesces = coalesce_count;
+    pthread_mutex_unlock(&heap_lock);
+
+    stats->mapped_bytes = mem_mapsize();
+    stats->peak_size = mem_heapsize_peak();
+    if (stats->free_bytes > 0)
+        stats->fragmentation = 1.0 - (double)stats->largest_free / stats->free_bytes;
 }
+
 /*
- * insert_front -- insert free block at front of free_listp
+ * mm_checkheap -- Check the heap at the given level, see mm.h. The first
+ * MM_CHECK_TOUCHED check is a full one, and so is one that comes after
+ * more than TOUCH_MAX blocks were touched.
  */
-static void insert_front(void *bp)
-{
-    if(free_listp == NULL){
+int mm_checkheap(int level) {
+    size_t nfree, nlisted;
+    bool ok = true;
+    int i;
+
+    pthread_mutex_lock(&heap_lock);
+    if (level == MM_CHECK_TOUCHED && touch_on && !touch_overflow) {
+        for (i = 0; ok && i < touch_count; i++)
+            if (touched[touch_slots[i]] != TOUCH_GONE)
+                ok = check_touched(__LINE__, touched[touch_slots[i]]);
+    } else if (level == MM_CHECK_FREE) {
+        ok = check_free_lists(__LINE__, &nlisted);
+    } else if (level != MM_CHECK_OFF) {
+        ok = check_heap(__LINE__, &nfree) && check_free_lists(__LINE__, &nlisted);
+        if (ok && nfree != nlisted) {
+            printf("(check_heap at line %d) Error: %zu free blocks, but %zu on the free lists\n",
+                   __LINE__, nfree, nlisted);
+            ok = false;
+        }
+    }
+    if (level == MM_CHECK_TOUCHED)
+        touch_on = true;
+    touch_reset();
+    pthread_mutex_unlock(&heap_lock);
+    return ok;
+}
 
-        //Inserting into empty free list
-        PUT_P(bp, NULL);
-        PUT_P(PADD(bp, 8), NULL);
-        free_listp = bp;
-    }else{
+/*
+ * mm_prof_start -- Start sampling about once every interval bytes, or stop
+ * with 0, see mm.h. Samples taken so far are forgotten either way.
+ */
+void mm_prof_start(size_t interval) {
+    pthread_mutex_lock(&prof_lock);
+    prof_interval = min(interval, LONG_MAX / 2);
+    pthread_mutex_unlock(&prof_lock);
+    prof_reset();
+}
 
-        //Inserting into free list with something
-        PUT_P(bp, NULL);
-        PUT_P(PADD(bp, 8), free_listp);
-        PUT_P(free_listp, bp);
-        free_listp = bp;
+/*
+ * mm_prof_dump -- Write the live samples to fp, grouped by call stack
+ */
+void mm_prof_dump(FILE *fp) {
+    int order[PROF_STACKS];
+    int i, n = 0;
+    size_t live_bytes = 0;
+    prof_stack_t *st;
+
+    pthread_mutex_lock(&prof_lock);
+    for (i = 0; i < PROF_STACKS; i++) {
+        if (prof_stacks[i].live_count > 0) {
+            order[n++] = i;
+            live_bytes += prof_stacks[i].live_bytes;
+        }
     }
-	return;
+    qsort(order, n, sizeof(int), cmp_stack);
+
+    fprintf(fp, "heap profile: %zu live bytes in %zu samples, %d stacks, interval %zu\n",
+            live_bytes, prof_live, n, prof_interval);
+    if (prof_dropped > 0)
+        fprintf(fp, "(%zu samples dropped, the tables were full)\n", prof_dropped);
+    for (i = 0; i < n; i++) {
+        st = &prof_stacks[order[i]];
+        fprintf(fp, "%zu live bytes in %zu samples (%zu bytes in %zu since the start):\n",
+                st->live_bytes, st->live_count, st->total_bytes, st->total_count);
+        fflush(fp);
+        backtrace_symbols_fd(st->frames, st->depth, fileno(fp));
+    }
+    fflush(fp);
+    pthread_mutex_unlock(&prof_lock);
 }
+
 /*
- * rmv_from_free -- removes free block from free_listp
+ * mm_malloc_sample -- Allocate a block for the inline mm_malloc once this
+ * thread's countdown to the next sample has run out, and take the sample
+ * While the profiler is off, this only winds the countdown back up.
  */
-static void rmv_from_free(void *bp)
-{
-    //the block being removed is in middle of a list of blocks
-    if (PREV_FREE_BLKP(bp) != NULL && NEXT_FREE_BLKP(bp) != NULL){
-        PUT_P(NEXT_FREE_BLKP(bp), PREV_FREE_BLKP(bp));
-        PUT_P(PADD(PREV_FREE_BLKP(bp), 8), NEXT_FREE_BLKP(bp));
-
-    //the block being removed is the first one in the free list
-    }else if (PREV_FREE_BLKP(bp) == NULL && NEXT_FREE_BLKP(bp) != NULL){
-        PUT_P(NEXT_FREE_BLKP(bp), NULL);
-        free_listp = NEXT_FREE_BLKP(bp);
+void *mm_malloc_sample(size_t size) {
+    void *frames[PROF_DEPTH + 1];
+    void *bp = mm_malloc_slow(size);
+    tcache_t *tc = get_tcache();
+    int depth = 0;
+
+    if (prof_interval == 0) {
+        tc->prof_left = PROF_IDLE;
+        return bp;
+    }
 
-    //the block being removed is the last one in the free list
-    }else if(PREV_FREE_BLKP(bp) != NULL && NEXT_FREE_BLKP(bp) == NULL){
-        PUT_P(PADD(PREV_FREE_BLKP(bp), 8), NULL);
+    /* outside the lock: the first backtrace loads the unwinder */
+    if (bp != NULL)
+        depth = backtrace(frames, PROF_DEPTH + 1);
 
-    //the block being removed is the only one in the free list
-    }else{
-        free_listp = NULL;
+    pthread_mutex_lock(&prof_lock);
+    if (prof_interval == 0) {
+        tc->prof_left = PROF_IDLE;
+    } else {
+        tc->prof_left = prof_gap();
+        /* leave out this function's own frame */
+        if (depth > 1)
+            prof_record(bp, size, frames + 1, depth - 1);
     }
-    return;
+    pthread_mutex_unlock(&prof_lock);
+    return bp;
 }
 
 /*
- * find_fit - Find a fit for a block with asize bytes
+ * mm_calloc -- Allocate a zeroed block for nmemb objects of size bytes
+ * A block the heap has just grown into is zero already, except for the
+ * free list links and footer it held while it was free, so only those and
+ * any recycled bytes in front of the new memory are cleared. Mapped blocks
+ * are new mappings and are not cleared at all.
  */
-static void *find_fit(size_t asize)
-{
-    void *bp;
+void *mm_calloc(size_t nmemb, size_t size) {
+    size_t bytes, payload, dirty, tail;
+    char *bp, *zero;
+
+    if (nmemb == 0 || size == 0 || nmemb > (size_t)-1 / size)
+        return NULL;
+    bytes = nmemb * size;
 
-    /* traverse free list */
-    for (bp = free_listp; bp != NULL; bp = NEXT_FREE_BLKP(bp)) {
-        if (asize <= (size_t)GET_SIZE(HDRP(bp)))
-	        return bp;
+    if (bytes >= MMAP_THRESHOLD)
+        return mmap_block(bytes);
+
+    /* not worth the lock, clearing them is cheap */
+    if (bytes <= TCACHE_MAX - HSIZE) {
+        if ((bp = mm_malloc(bytes)) != NULL)
+            memset(bp, 0, bytes);
+        return bp;
     }
 
-    return NULL; // No fit
+    pthread_mutex_lock(&heap_lock);
+    zero = mem_zero_lo();
+    bp = malloc_block(adjust_size(bytes));
+    pthread_mutex_unlock(&heap_lock);
+    if (bp == NULL)
+        return NULL;
+
+    /* clear up to the fresh memory, or at least the links or treap node */
+    payload = GET_SIZE(HDRP(bp)) - HSIZE;
+    dirty = (zero > bp) ? (size_t)(zero - bp) : 0;
+    dirty = min(max(dirty, 3 * WSIZE), payload);
+    memset(bp, 0, dirty);
+    /* and the old footer, if the block was not split */
+    tail = max(dirty, payload - DSIZE);
+    memset(bp + tail, 0, payload - tail);
+    return bp;
 }
 
 /*
- * extend_heap - Extend heap with free block and return its block pointer
+ * mm_memalign -- Allocate a block whose payload address is a multiple of
+ * alignment, a power of two. The space skipped in front of it stays free.
  */
-static void *extend_heap(size_t words) {
-    char *bp;
-    size_t size;
+void *mm_memalign(size_t alignment, size_t size) {
+    void *bp;
 
-    /* Allocate an even number of words to maintain alignment */
-    size = words * WSIZE;
-    if (words % 2 == 1)
-        size += WSIZE;
-    // printf("extending heap to %zu bytes\n", mem_heapsize());
-    if ((long)(bp = mem_sbrk(size)) < 0)
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+        return NULL;
+    if (alignment <= DSIZE)
+        return mm_malloc(size);
+    if (size == 0 || size >= MAX_HEAP || alignment >= MAX_HEAP)
         return NULL;
 
-    /* Initialize free block header/footer and the epilogue header */
-    PUT(HDRP(bp), PACK(size, 0));         /* free block header */
-    PUT(FTRP(bp), PACK(size, 0));         /* free block footer */
-    PUT(PADD(HDRP(bp), WSIZE), 0);
-    PUT(PADD(HDRP(bp), DSIZE), 0);
-    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* new epilogue header */
+    pthread_mutex_lock(&heap_lock);
+    bp = malloc_aligned(adjust_size(size), alignment);
+    pthread_mutex_unlock(&heap_lock);
+    return bp;
+}
 
-    /* Coalesce if the previous block was free */
-    return coalesce(bp);
+/*
+ * mm_aligned_alloc -- The C11 spelling of mm_memalign
+ */
+void *mm_aligned_alloc(size_t alignment, size_t size) {
+    return mm_memalign(alignment, size);
 }
 
 /*
- * check_heap -- Performs basic heap consistency checks for an implicit free list allocator
- * and prints out all blocks in the heap in memory order.
- * Checks include proper prologue and epilogue, alignment, and matching header and footer
- * Takes a line number (to give the output an identifying tag).
+ * mm_malloc_batch -- Allocate n blocks of size bytes, storing them in out
+ * Returns how many blocks were allocated, fewer than n only if the heap ran
+ * out. Slab objects and mapped blocks are allocated one at a time.
  */
-static bool check_heap(int line) {
-    char *bp;
+size_t mm_malloc_batch(size_t size, size_t n, void **out) {
+    size_t asize;
+    size_t done = 0;
+    size_t k, got;
+
+    if (size == 0)
+        return 0;
+
+    if (size <= SLAB_MAX || size >= MMAP_THRESHOLD) {
+        for (; done < n; done++)
+            if ((out[done] = mm_malloc(size)) == NULL)
+                break;
+        return done;
+    }
 
-    if ((GET_SIZE(HDRP(heap_start)) != DSIZE) || !GET_ALLOC(HDRP(heap_start))) {
-        printf("(check_heap at line %d) Error: bad prologue header\n", line);
-        return false;
+    /* carve at most MMAP_THRESHOLD bytes at a time, so one fit stays cheap */
+    asize = adjust_size(size);
+    pthread_mutex_lock(&heap_lock);
+    while (done < n) {
+        k = min(n - done, max(MMAP_THRESHOLD / asize, 1));
+        done += (got = carve_blocks(asize, k, out + done));
+        if (got < k)
+            break;
     }
+    pthread_mutex_unlock(&heap_lock);
+    return done;
+}
 
-    for (bp = heap_start; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
-        if (!check_block(line, bp)) {
-            return false;
+/*
+ * mm_free_batch -- Free the n blocks in ptrs, which is left as it is
+ * A run of heap blocks that are next to each other goes back as one block.
+ * Every block is checked as mm_free checks it, and one that is not
+ * allocated, sits in a thread cache or is in ptrs twice is reported and
+ * left alone.
+ */
+void mm_free_batch(void **ptrs, size_t n) {
+    void *sorted[BATCH_SORT];
+    char *bp, *last;
+    size_t i, j, k, m;
+    int kind;
+
+    tcache_t *tc = get_tcache();
+
+    pthread_mutex_lock(&heap_lock);
+    for (i = 0; i < n; ) {
+        for (m = 0; i < n && m < BATCH_SORT; i++) {
+            bp = ptrs[i];
+            kind = page_kind(bp);
+            if (kind == PAGE_HEAP) {
+                CHECK_HDR(HDRP(bp));
+                if (GET_MAPPED(HDRP(bp))) {
+                    sorted[m++] = bp;
+                    continue;
+                }
+                if (!free_ok(bp))
+                    continue;
+            }
+            if (kind != PAGE_SHORT && tcache_holds(tc, bp, kind)) {
+                DOUBLE_FREE(bp);
+                continue;
+            }
+            sorted[m++] = bp;
+        }
+        qsort(sorted, m, sizeof(void *), cmp_ptr);
+
+        for (j = 0; j < m; j = k) {
+            bp = sorted[j];
+            k = j + 1;
+            if (j > 0 && bp == sorted[j - 1]) {
+                DOUBLE_FREE(bp);
+                continue;
+            }
+            PROF_FORGET(bp);
+            kind = page_kind(bp);
+            if (kind == PAGE_SHORT) {
+                short_free(bp);
+            } else if (kind == PAGE_SLAB) {
+                slab_free(bp);
+            } else if (GET_MAPPED(HDRP(bp))) {
+                munmap_block(bp);
+            } else {
+                /* take in the allocated blocks that follow bp in the heap,
+                 * marking each free so that freeing it again is caught */
+                for (last = bp; k < m && sorted[k] == NEXT_BLKP(last) &&
+                         page_kind(sorted[k]) == PAGE_HEAP &&
+                         GET_ALLOC(HDRP(sorted[k])); k++) {
+                    last = sorted[k];
+                    PUT_HDR(HDRP(last), PACK(GET_SIZE(HDRP(last)), 0));
+                    PROF_FORGET(last);
+                    UNTOUCH(last);
+                }
+                if (last == bp) {
+                    free_block(bp);
+                } else {
+                    coalesce_count += k - j - 1;
+                    PUT_HDR(HDRP(bp), PACK(NEXT_BLKP(last) - bp, 1));
+                    release_block(bp);
+                }
+            }
         }
     }
+    pthread_mutex_unlock(&heap_lock);
+}
 
-    if ((GET_SIZE(HDRP(bp)) != 0) || !(GET_ALLOC(HDRP(bp)))) {
-        printf("(check_heap at line %d) Error: bad epilogue header\n", line);
-        return false;
-    }
 
-    return true;
+/* The remaining routines are internal helper routines */
+
+/*
+ * adjust_size -- Returns the block size needed for a payload of size bytes
+ */
+static size_t adjust_size(size_t size) {
+    /* Adjust block size to include overhead and alignment reqs.
+     * Allocated blocks only pay for their header, but the block must be
+     * big enough to hold the links and footer once it is freed. */
+    if (size <= MIN_BLOCK - HSIZE)
+        return MIN_BLOCK;
+
+    /* Add header and then round up to nearest multiple of double-word alignment */
+    return DSIZE * ((size + HSIZE + (DSIZE - 1)) / DSIZE);
 }
 
 /*
- * check_block -- Checks a block for alignment and matching header and footer
+ * grow_reserve -- Returns the block size to keep for a block that realloc
+ * keeps growing and now needs asize bytes: half as much again, so the block
+ * is only copied a constant number of times each time it doubles
  */
-static bool check_block(int line, void *bp) {
-    if ((size_t)bp % DSIZE) {
-        printf("(check_heap at line %d) Error: %p is not double-word aligned\n", line, bp);
-        return false;
-    }
-    if (GET(HDRP(bp)) != GET(FTRP(bp))) {
-        printf("(check_heap at line %d) Error: header does not match footer\n", line);
-        return false;
-    }
-    return true;
+static size_t grow_reserve(size_t asize) {
+    size_t slack = min(asize / 2, GROW_SLACK_MAX);
+
+    return DSIZE * ((asize + slack + (DSIZE - 1)) / DSIZE);
 }
 
 /*
- * print_heap -- Prints out the current state of the implicit free list
+ * malloc_block -- Allocate a block of asize bytes from the shared heap
+ * Precondition: caller holds heap_lock
  */
-static void print_heap() {
+static void *malloc_block(size_t asize) {
+    size_t extendsize; /* amount to extend heap if no fit */
     char *bp;
+    int class;
+
+    /* A block of exactly this size that is waiting on a quick list is still
+     * marked allocated, so it can be handed out as it is */
+    if (asize < SMALL_LIMIT && (bp = quick_lists[class = size_class(asize)]) != NULL) {
+        quick_lists[class] = STACK_NEXT(bp);
+        quick_counts[class]--;
+        UNMARK_CACHED(bp);
+        return bp;
+    }
 
-    printf("Heap (%p):\n", heap_start);
-
-    for (bp = heap_start; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
-        print_block(bp);
+    /* Search the free list for a fit, coalescing the quick lists if there is none */
+    if ((bp = find_fit(asize)) != NULL || (quick_flush_all() && (bp = find_fit(asize)) != NULL)) {
+        place(bp, asize);
+        return bp;
     }
+    /* No fit found. Get more memory and place the block */
+    extendsize = max(asize, CHUNKSIZE);
+    if ((bp = extend_heap(extendsize / WSIZE)) == NULL)
+        return NULL;
 
-    print_block(bp);
+    place(bp, asize);
+    return bp;
 }
 
 /*
- * print_heap -- Prints out the current state of the implicit free list
+ * carve_blocks -- Allocates n blocks of asize bytes, returning how many it
+ * got. If one free block can hold them all it is split into the n blocks,
+ * the last of which keeps any slack too small to split off. Otherwise they
+ * are allocated one by one, so that they fill holes before the heap grows.
+ * Precondition: caller holds heap_lock
  */
-static void print_free_heap() {
+static size_t carve_blocks(size_t asize, size_t n, void **out) {
     char *bp;
-    printf("Heap (%p):\n", free_listp);
+    size_t rest;
+    size_t i;
+
+    if ((bp = find_fit(asize * n)) == NULL) {
+        for (i = 0; i < n; i++)
+            if ((out[i] = malloc_block(asize)) == NULL)
+                break;
+        return i;
+    }
 
-    for (bp = free_listp; bp != NULL; bp = NEXT_FREE_BLKP(bp)) {
-        print_block(bp);
+    place(bp, asize * n);
+    split_count += n - 1;
+    rest = GET_SIZE(HDRP(bp));
+    out[0] = bp;
+    for (i = 1; i < n; i++) {
+        PUT_HDR(HDRP(bp), PACK(asize, 1));
+        rest -= asize;
+        bp = NEXT_BLKP(bp);
+        PUT(HDRP(bp), PACK(rest, PREV_ALLOC | 1));
+        TOUCH(bp);
+        out[i] = bp;
     }
+    return n;
 }
 
 /*
- * print_block -- Prints out the current state of a block
+ * free_block -- Return an allocated block to the shared heap
+ * Precondition: caller holds heap_lock
  */
-static void print_block(void *bp) {
-    size_t hsize, halloc, fsize, falloc;
+static void free_block(void *bp) {
+    char *curHdr = HDRP(bp);
+    size_t blockSize = GET_SIZE(curHdr);
+    int class;
 
-    hsize = GET_SIZE(HDRP(bp));
-    halloc = GET_ALLOC(HDRP(bp));
-    fsize = GET_SIZE(FTRP(bp));
-    falloc = GET_ALLOC(FTRP(bp));
+    if (!free_ok(bp))
+        return;
+
+    /* small blocks wait on a quick list, still marked allocated, but
+     * whoever gets one back has not grown it */
+    if (blockSize < SMALL_LIMIT) {
+        class = size_class(blockSize);
+        CLR_GROWN(curHdr);
+        SET_STACK_NEXT(bp, quick_lists[class]);
+        MARK_CACHED(bp);
+        quick_lists[class] = bp;
+        if (++quick_counts[class] > QUICK_LIMIT)
+            quick_flush(class);
+        return;
+    }
+
+    release_block(bp);
+}
+
+/*
+ * free_ok -- Returns whether the heap block bp is allocated and may be
+ * freed, reporting a double free otherwise. A block waiting on a quick
+ * list still looks allocated, so only HARDENED's key, or being the last
+ * one queued, gives it away.
+ * Precondition: caller holds heap_lock
+ */
+static bool free_ok(void *bp) {
+    char *curHdr = HDRP(bp);
+    size_t blockSize;
+
+    CHECK_HDR(curHdr);
+    blockSize = GET_SIZE(curHdr);
+    if (GET_ALLOC(curHdr) == 0 || IS_CACHED(bp) ||
+        (blockSize < SMALL_LIMIT && quick_lists[size_class(blockSize)] == bp)) {
+        DOUBLE_FREE(bp);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * tcache_holds -- Returns whether the slab object or heap block bp is in a
+ * thread cache, as far as can be told: HARDENED's key, or being on top of
+ * its bin in tc, since a cached block still looks allocated
+ */
+static bool tcache_holds(tcache_t *tc, void *bp, int kind) {
+    size_t blockSize;
+
+    if (IS_CACHED(bp))
+        return true;
+    if (kind == PAGE_SLAB)
+        return tc->bins[SLAB_RUNP(bp)->class] == bp;
+    blockSize = GET_SIZE(HDRP(bp));
+    return blockSize >= TCACHE_MIN && blockSize <= TCACHE_MAX &&
+        tc->bins[SLAB_CLASSES + (blockSize - TCACHE_MIN) / DSIZE] == bp;
+}
+
+/*
+ * release_block -- Marks the allocated block bp free and coalesces it
+ * Precondition: caller holds heap_lock
+ */
+static void release_block(void *bp) {
+    size_t blockSize = GET_SIZE(HDRP(bp));
+
+    PUT_HDR(HDRP(bp), PACK(blockSize, 0));
+    PUT(FTRP(bp), PACK(blockSize, 0));
+    trim_heap(coalesce(bp));
+}
+
+/*
+ * quick_flush -- Frees and coalesces every block waiting on a quick list
+ * Precondition: caller holds heap_lock
+ */
+static void quick_flush(int class) {
+    void *bp;
+
+    while ((bp = quick_lists[class]) != NULL) {
+        quick_lists[class] = STACK_NEXT(bp);
+        UNMARK_CACHED(bp);
+        release_block(bp);
+    }
+    quick_counts[class] = 0;
+}
+
+/*
+ * quick_flush_all -- Flushes every quick list, returns whether any block
+ * was freed
+ * Precondition: caller holds heap_lock
+ */
+static bool quick_flush_all(void) {
+    bool flushed = false;
+    int class;
+
+    for (class = 0; class < NUM_CLASSES; class++) {
+        if (quick_counts[class] > 0) {
+            quick_flush(class);
+            flushed = true;
+        }
+    }
+    return flushed;
+}
+
+/*
+ * get_tcache -- Returns this thread's cache, emptied first if it holds
+ * blocks from before the last mm_init. The first time round, the cache is
+ * also set to be flushed when the thread exits.
+ */
+static tcache_t *get_tcache(void) {
+    tcache_t *tc = &mm_tcache;
+
+    if (tc->epoch != mm_heap_epoch) {
+        memset(tc, 0, sizeof(*tc));
+        tc->epoch = mm_heap_epoch;
+        pthread_once(&tcache_key_once, tcache_key_create);
+        pthread_setspecific(tcache_key, tc);
+    }
+    return tc;
+}
+
+/*
+ * tcache_key_create -- Creates tcache_key, once per process
+ */
+static void tcache_key_create(void) {
+    pthread_key_create(&tcache_key, tcache_exit);
+}
+
+/*
+ * tcache_exit -- Returns every block in the cache of an exiting thread to
+ * the shared heap, unless they belong to a heap from before the last mm_init
+ */
+static void tcache_exit(void *ptr) {
+    tcache_t *tc = (tcache_t *)ptr;
+    int bin;
+
+    if (tc->epoch != mm_heap_epoch)
+        return;
+    for (bin = 0; bin < TCACHE_BINS; bin++)
+        while (tc->bins[bin] != NULL)
+            tcache_flush(tc, bin);
+}
+
+/*
+ * tcache_refill -- Moves a batch of fresh slab objects or blocks for bin
+ * from the shared heap into the empty bin, taking heap_lock once. The batch
+ * doubles on every refill so that only bins that really are busy hold
+ * spare blocks.
+ * (place may leave a block a little bigger than the bin's size, which is
+ * harmless: every block in a bin is at least the bin's size)
+ */
+static void tcache_refill(tcache_t *tc, int bin) {
+    void *bp;
+    int i;
+    int fill = max(tc->fills[bin], 1);
+
+    tc->fills[bin] = min(2 * fill, TCACHE_BATCH);
+
+    pthread_mutex_lock(&heap_lock);
+    for (i = 0; i < fill; i++) {
+        if (bin < SLAB_CLASSES)
+            bp = slab_alloc(bin);
+        else
+            bp = malloc_block(TCACHE_MIN + (bin - SLAB_CLASSES) * DSIZE);
+        if (bp == NULL)
+            break;
+        SET_STACK_NEXT(bp, tc->bins[bin]);
+        MARK_CACHED(bp);
+        tc->bins[bin] = bp;
+        tc->counts[bin]++;
+    }
+    pthread_mutex_unlock(&heap_lock);
+}
+
+/*
+ * tcache_flush -- Returns TCACHE_BATCH blocks of a full bin to the shared
+ * heap, taking heap_lock once
+ */
+static void tcache_flush(tcache_t *tc, int bin) {
+    void *bp;
+    int i;
+
+    pthread_mutex_lock(&heap_lock);
+    for (i = 0; i < TCACHE_BATCH && (bp = tc->bins[bin]) != NULL; i++) {
+        tc->bins[bin] = STACK_NEXT(bp);
+        tc->counts[bin]--;
+        UNMARK_CACHED(bp);
+        if (bin < SLAB_CLASSES)
+            slab_free(bp);
+        else
+            free_block(bp);
+    }
+    pthread_mutex_unlock(&heap_lock);
+}
+
+/*
+ * malloc_aligned -- Allocate a block of asize bytes whose payload address is
+ * a multiple of align. The free space in front of it is split off as its own
+ * free block rather than wasted. The heap starts on a page boundary, so for
+ * align up to SLAB_RUN this is also a multiple of align from the heap start.
+ * Precondition: caller holds heap_lock, align is a power of two >= DSIZE
+ */
+static void *malloc_aligned(size_t asize, size_t align) {
+    char *bp, *abp;
+    size_t size, gap;
+
+    /* any block this big has an aligned spot with room for a free block in front,
+     * and failing that a smaller free block may happen to have one */
+    if ((bp = find_fit(asize + align + MIN_BLOCK)) == NULL &&
+        (!quick_flush_all() || (bp = find_fit(asize + align + MIN_BLOCK)) == NULL) &&
+        (bp = find_aligned_fit(asize, align)) == NULL) {
+        /* otherwise grow the heap by just enough past the free tail block (if any) */
+        bp = PADD(mem_heap_hi(), 1);
+        size = 0;
+        if (!GET_PREV_ALLOC(HDRP(bp))) {
+            size = GET_SIZE(PSUB(bp, OVERHEAD));
+            bp = PSUB(bp, size);
+        }
+        abp = ALIGN_UP(bp, align);
+        if (abp != bp && (size_t)(abp - bp) < MIN_BLOCK)
+            abp = PADD(abp, align);
+        /* the tail may already be big enough, just not for find_fit's worst case */
+        if ((size_t)(abp - bp) + asize > size &&
+            (bp = extend_heap(max(abp - bp + asize - size, MIN_BLOCK) / WSIZE)) == NULL)
+            return NULL;
+    }
+
+    abp = ALIGN_UP(bp, align);
+    if (abp != bp && (size_t)(abp - bp) < MIN_BLOCK)
+        abp = PADD(abp, align);
+
+    /* split the leading fragment off as a free block of its own */
+    gap = abp - bp;
+    if (gap > 0) {
+        split_count++;
+        size = GET_SIZE(HDRP(bp));
+        rmv_from_free(bp);
+        PUT_HDR(HDRP(bp), PACK(gap, 0));
+        PUT(FTRP(bp), PACK(gap, 0));
+        insert_front(bp);
+        PUT(HDRP(abp), PACK(size - gap, 0));
+        PUT(FTRP(abp), PACK(size - gap, 0));
+        insert_front(abp);
+    }
+
+    place(abp, asize);
+    return abp;
+}
+
+/*
+ * find_aligned_fit -- Returns the first free block with room for asize bytes
+ * at an align-byte boundary, leaving either nothing or a whole free block in
+ * front, or NULL if there is none. Walks the whole heap, so malloc_aligned
+ * only calls it once the free lists have nothing big enough to be sure.
+ */
+static void *find_aligned_fit(size_t asize, size_t align) {
+    char *bp, *abp;
+    size_t size;
+
+    for (bp = heap_start; (size = GET_SIZE(HDRP(bp))) > 0; bp = NEXT_BLKP(bp)) {
+        if (GET_ALLOC(HDRP(bp)) || size < asize)
+            continue;
+        abp = ALIGN_UP(bp, align);
+        if (abp != bp && (size_t)(abp - bp) < MIN_BLOCK)
+            abp = PADD(abp, align);
+        if ((size_t)(abp - bp) + asize <= size)
+            return bp;
+    }
+    return NULL;
+}
+
+/*
+ * mmap_block -- Allocate a block for a payload of size bytes in a region of
+ * its own, outside the heap
+ */
+static void *mmap_block(size_t size) {
+    size_t pagesize = mem_pagesize();
+    size_t rsize;
+    char *region;
+
+    /* the region size, padding included, must not wrap around */
+    if (size > (size_t)-1 - DSIZE - pagesize + 1)
+        return NULL;
+    rsize = (size + DSIZE + pagesize - 1) & ~(pagesize - 1);
+
+    /* the header has to be able to hold the size */
+    if ((word_t)rsize != rsize || (region = mem_map(rsize)) == NULL)
+        return NULL;
+    /* the header is preceded by padding, so that the payload is DSIZE aligned */
+    PUT(HDRP(PADD(region, DSIZE)), PACK(rsize, MAPPED | 1));
+    return PADD(region, DSIZE);
+}
+
+/*
+ * munmap_block -- Free a block made by mmap_block, unmapping its region
+ */
+static void munmap_block(void *bp) {
+    mem_unmap(PSUB(bp, DSIZE));
+}
+
+/*
+ * slab_capacity -- Returns how many objects a run of the given class holds
+ */
+static int slab_capacity(int class) {
+    return (SLAB_RUN - SLAB_HDR) / ((class + 1) * DSIZE);
+}
+
+/*
+ * page_kind -- Returns what the page bp points into is used for
+ */
+static int page_kind(void *bp) {
+    /* mapped blocks lie outside the heap, possibly below it */
+    return HEAP_OFF(bp) < MAX_HEAP ? page_kinds[HEAP_PAGE(bp)] : PAGE_HEAP;
+}
+
+/*
+ * slab_alloc -- Returns a free object of the given class, starting a new
+ * run if no run of that class has one
+ * Precondition: caller holds heap_lock
+ */
+static void *slab_alloc(int class) {
+    slab_run_t *run = slab_runs[class];
+    int i, w;
+
+    if (run == NULL) {
+        /* the run's page is the payload of a block with one spare word after it */
+        if ((run = malloc_aligned(SLAB_RUN + DSIZE, SLAB_RUN)) == NULL)
+            return NULL;
+        page_kinds[HEAP_PAGE(run)] = PAGE_SLAB;
+
+        run->next = NULL;
+        run->prev = NULL;
+        run->class = class;
+        run->nfree = slab_capacity(class);
+        memset(run->bitmap, 0, sizeof(run->bitmap));
+        for (i = 0; i < (int)run->nfree; i++)
+            run->bitmap[i / 64] |= 1UL << (i % 64);
+        slab_runs[class] = run;
+    }
+
+    /* take the lowest free object */
+    for (w = 0; run->bitmap[w] == 0; w++)
+        ;
+    i = __builtin_ctzl(run->bitmap[w]);
+    run->bitmap[w] &= ~(1UL << i);
+
+    /* a full run leaves the list until one of its objects is freed */
+    if (--run->nfree == 0)
+        slab_unlink(run);
+
+    return PADD(run, SLAB_HDR + (w * 64 + i) * (class + 1) * DSIZE);
+}
+
+/*
+ * slab_free -- Returns an object to its run. A run that becomes empty goes
+ * back to the heap unless it is the only run left for its class.
+ * Precondition: caller holds heap_lock
+ */
+static void slab_free(void *bp) {
+    slab_run_t *run = SLAB_RUNP(bp);
+    int i = (PSUB(bp, SLAB_HDR) - (char *)run) / ((run->class + 1) * DSIZE);
+
+    if (run->bitmap[i / 64] & (1UL << (i % 64))) {
+        DOUBLE_FREE(bp);
+        return;
+    }
+    run->bitmap[i / 64] |= 1UL << (i % 64);
+
+    /* a full run gets a free object, so it goes back on the list */
+    if (run->nfree++ == 0) {
+        run->prev = NULL;
+        run->next = slab_runs[run->class];
+        if (run->next != NULL)
+            run->next->prev = run;
+        slab_runs[run->class] = run;
+    }
+
+    if ((int)run->nfree == slab_capacity(run->class)
+        && (run->next != NULL || run->prev != NULL)) {
+        slab_unlink(run);
+        page_kinds[HEAP_PAGE(run)] = PAGE_HEAP;
+        free_block(run);
+    }
+}
+
+/*
+ * slab_unlink -- Removes a run from the list of runs with free objects
+ */
+static void slab_unlink(slab_run_t *run) {
+    if (run->prev != NULL)
+        run->prev->next = run->next;
+    else
+        slab_runs[run->class] = run->next;
+    if (run->next != NULL)
+        run->next->prev = run->prev;
+}
+
+/*
+ * short_alloc -- Bump allocate a short-lived object of size bytes from the
+ * short chunk being filled, starting a new chunk when it is full
+ * Precondition: caller holds heap_lock
+ */
+static void *short_alloc(size_t size) {
+    size_t ssize = DSIZE * ((size + WSIZE + (DSIZE - 1)) / DSIZE);
+    short_chunk_t *chunk = short_chunk;
+    char *bp;
+
+    if (chunk == NULL || PADD(chunk->bump, ssize) > PADD(chunk, SLAB_RUN)) {
+        /* a full chunk is left to its objects, it goes back once they are freed */
+        if ((chunk = malloc_aligned(SLAB_RUN + DSIZE, SLAB_RUN)) == NULL)
+            return NULL;
+        page_kinds[HEAP_PAGE(chunk)] = PAGE_SHORT;
+        short_bytes += GET_SIZE(HDRP(chunk));
+
+        chunk->bump = PADD(chunk, SHORT_HDR);
+        chunk->live = 0;
+        short_chunk = chunk;
+    }
+
+    /* the size word before the object holds its payload size, and bit 0 once it is freed */
+    bp = PADD(chunk->bump, WSIZE);
+    PUT(chunk->bump, ssize - WSIZE);
+    chunk->bump = PADD(chunk->bump, ssize);
+    chunk->live++;
+    return bp;
+}
+
+/*
+ * short_free -- Free a short-lived object, recycling its chunk if it was the
+ * last live object in it
+ * Precondition: caller holds heap_lock
+ */
+static void short_free(void *bp) {
+    short_chunk_t *chunk = SHORT_CHUNKP(bp);
+
+    if (GET(PSUB(bp, WSIZE)) & 0x1) {
+        DOUBLE_FREE(bp);
+        return;
+    }
+    PUT(PSUB(bp, WSIZE), GET(PSUB(bp, WSIZE)) | 0x1);
+
+    if (--chunk->live > 0)
+        return;
+    if (chunk == short_chunk) {
+        chunk->bump = PADD(chunk, SHORT_HDR);
+    } else {
+        page_kinds[HEAP_PAGE(chunk)] = PAGE_HEAP;
+        short_bytes -= GET_SIZE(HDRP(chunk));
+        free_block(chunk);
+    }
+}
+
+/*
+ * prof_reset -- Forgets every sample and call stack
+ */
+static void prof_reset(void) {
+    pthread_mutex_lock(&prof_lock);
+    memset(prof_samples, 0, sizeof(prof_samples));
+    memset(prof_stacks, 0, sizeof(prof_stacks));
+    memset(prof_marks, 0, sizeof(prof_marks));
+    prof_live = 0;
+    prof_nstacks = 0;
+    prof_dropped = 0;
+    pthread_mutex_unlock(&prof_lock);
+}
+
+/*
+ * prof_gap -- Returns the bytes to allocate before the next sample, drawn
+ * evenly from 1 to 2 * prof_interval so that samples do not fall in step
+ * with a program that allocates in a fixed pattern. Needs prof_lock.
+ */
+static long prof_gap(void) {
+    /* xorshift64 */
+    prof_seed ^= prof_seed << 13;
+    prof_seed ^= prof_seed >> 7;
+    prof_seed ^= prof_seed << 17;
+    return 1 + prof_seed % (2 * prof_interval);
+}
+
+/*
+ * prof_stack -- Returns the index in prof_stacks of the call stack frames,
+ * adding it if it is new, or -1 if the table is too full. Needs prof_lock.
+ */
+static int prof_stack(void **frames, int depth) {
+    size_t hash = depth;
+    int i;
+
+    for (i = 0; i < depth; i++)
+        hash = mix(hash ^ (size_t)frames[i]);
+
+    /* open addressing, kept at most 3/4 full */
+    for (i = hash & (PROF_STACKS - 1); prof_stacks[i].depth > 0; i = (i + 1) & (PROF_STACKS - 1)) {
+        if (prof_stacks[i].depth == depth
+            && memcmp(prof_stacks[i].frames, frames, depth * sizeof(void *)) == 0)
+            return i;
+    }
+    if (prof_nstacks >= PROF_STACKS / 4 * 3)
+        return -1;
+    memcpy(prof_stacks[i].frames, frames, depth * sizeof(void *));
+    prof_stacks[i].depth = depth;
+    prof_nstacks++;
+    return i;
+}
+
+/*
+ * prof_record -- Remembers block bp of size bytes as a sample taken at the
+ * call stack frames. Needs prof_lock.
+ */
+static void prof_record(void *bp, size_t size, void **frames, int depth) {
+    size_t bytes = max(size, prof_interval);
+    int stack, i;
+
+    if (prof_live >= PROF_SAMPLES / 4 * 3 || (stack = prof_stack(frames, depth)) < 0) {
+        prof_dropped++;
+        return;
+    }
+
+    for (i = mix((size_t)bp) & (PROF_SAMPLES - 1); prof_samples[i].bp != NULL; i = (i + 1) & (PROF_SAMPLES - 1))
+        ;
+    prof_samples[i].bp = bp;
+    prof_samples[i].bytes = bytes;
+    prof_samples[i].stack = stack;
+    prof_live++;
+    prof_marks[PROF_MARK(bp)]++;
+
+    prof_stacks[stack].live_bytes += bytes;
+    prof_stacks[stack].live_count++;
+    prof_stacks[stack].total_bytes += bytes;
+    prof_stacks[stack].total_count++;
+}
+
+/*
+ * prof_forget -- Drops the sample of block bp, which is being freed, if
+ * there is one. Only called when prof_marks says there might be.
+ */
+static void prof_forget(void *bp) {
+    size_t mask = PROF_SAMPLES - 1;
+    size_t i, j, home;
+    prof_sample_t *sp;
+
+    pthread_mutex_lock(&prof_lock);
+    for (i = mix((size_t)bp) & mask; prof_samples[i].bp != bp; i = (i + 1) & mask) {
+        if (prof_samples[i].bp == NULL) {
+            pthread_mutex_unlock(&prof_lock);
+            return;
+        }
+    }
+    sp = &prof_samples[i];
+    prof_stacks[sp->stack].live_bytes -= sp->bytes;
+    prof_stacks[sp->stack].live_count--;
+    prof_marks[PROF_MARK(bp)]--;
+    prof_live--;
+
+    /* close the gap: move back every later sample of the run that may */
+    for (j = (i + 1) & mask; prof_samples[j].bp != NULL; j = (j + 1) & mask) {
+        home = mix((size_t)prof_samples[j].bp) & mask;
+        /* it may unless its home slot lies cyclically in (i, j] */
+        if ((j > i) ? (home <= i || home > j) : (home <= i && home > j)) {
+            prof_samples[i] = prof_samples[j];
+            i = j;
+        }
+    }
+    prof_samples[i].bp = NULL;
+    pthread_mutex_unlock(&prof_lock);
+}
+
+/*
+ * place -- Place block of asize bytes at start of free block bp
+ *          and <How are you handling splitting?>
+ * Takes a pointer to a free block and the size of block to place inside it
+ * Returns nothing
+ * Precondition: We know that there is room in the list because both times place is called,
+ * in malloc, we know that there is room avaliable. Called after find_fit and extend_heap.
+ # Precondition: asize is a factor of 16.
+ * Postcondition: Placed block has an allocated tag
+ */
+static void place(void *bp, size_t asize) {
+    size_t curSize = GET_SIZE(HDRP(bp));
+
+    CHECK_HDR(HDRP(bp));
+    rmv_from_free(bp);
+    PUT_HDR(HDRP(bp), PACK(curSize, 1));
+    TOUCH(bp);
+    trim_block(bp, asize);
+}
+
+/*
+ * trim_block -- Shrinks the allocated block bp to asize bytes, giving the
+ * surplus back to the heap as a free block when it is big enough to be one
+ * Postcondition: the block after bp knows that bp is allocated
+ */
+static void trim_block(void *bp, size_t asize) {
+    size_t curSize = GET_SIZE(HDRP(bp));
+
+    /* enough space for free block, split */
+    if ((curSize - asize) >= MIN_BLOCK) {
+        split_count++;
+        PUT_HDR(HDRP(bp), PACK(asize, 1));
+
+        char *nextBp = NEXT_BLKP(bp);
+        PUT(HDRP(nextBp), PACK(curSize-asize, PREV_ALLOC));
+        PUT(FTRP(nextBp), PACK(curSize-asize, 0));
+        coalesce(nextBp);
+    }
+    /* not enough space for free block, don't split */
+    else {
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+    }
+}
+
+/*
+ * realloc_in_place -- Resizes the allocated block bp to asize bytes without
+ * copying it elsewhere, if possible. Up to keep bytes (keep >= asize) of
+ * whatever space that frees up stay with the block. In order of preference it
+ *   - shrinks bp, splitting off the surplus,
+ *   - grows bp into a free next block,
+ *   - grows bp backwards into a free previous block, moving the data down,
+ *   - grows the heap by the missing bytes when bp and its free neighbours
+ *     end the heap.
+ * Returns the new block pointer, or NULL if the block has to be moved.
+ * Precondition: caller holds heap_lock
+ */
+static void *realloc_in_place(void *bp, size_t asize, size_t keep) {
+    size_t oldsize = GET_SIZE(HDRP(bp));
+    char *next = NEXT_BLKP(bp);
+    size_t nextsize = GET_ALLOC(HDRP(next)) ? 0 : GET_SIZE(HDRP(next));
+    char *prev = GET_PREV_ALLOC(HDRP(bp)) ? NULL : PREV_BLKP(bp);
+    size_t prevsize = (prev != NULL) ? GET_SIZE(HDRP(prev)) : 0;
+
+    TOUCH(bp);
+    if (asize <= oldsize) {
+        trim_block(bp, min(oldsize, keep));
+        return bp;
+    }
+
+    if (oldsize + nextsize + prevsize < asize) {
+        /* only the end of the heap can make up the difference */
+        if (GET_SIZE(HDRP(PADD(next, nextsize))) != 0)
+            return NULL;
+        if (extend_heap(max(asize - oldsize - nextsize - prevsize, MIN_BLOCK) / WSIZE) == NULL)
+            return NULL;
+        /* the new space has been coalesced with the free next block, if any */
+        nextsize = GET_SIZE(HDRP(next));
+    }
+
+    /* the next block alone is enough, so nothing has to move */
+    if (oldsize + nextsize >= asize) {
+        rmv_from_free(next);
+        PUT_HDR(HDRP(bp), PACK(oldsize + nextsize, 1));
+        trim_block(bp, min(oldsize + nextsize, keep));
+        return bp;
+    }
+
+    /* otherwise slide the block down into the free previous block */
+    rmv_from_free(prev);
+    if (nextsize > 0)
+        rmv_from_free(next);
+    PUT_HDR(HDRP(prev), PACK(prevsize + oldsize + nextsize, 1));
+    UNTOUCH(bp);
+    TOUCH(prev);
+    memmove(prev, bp, oldsize - HSIZE);
+    trim_block(prev, min(prevsize + oldsize + nextsize, keep));
+    return prev;
+}
+
+
+
+/*
+ * coalesce -- Boundary tag coalescing.
+ * Takes a pointer to a free block
+ * Return ptr to coalesced block
+ * Precondition: bp has a free header and footer and is in no free list
+ * Postcondition: the coalesced block is in its free list and the block
+ * after it has its prev-alloc bit cleared
+ */
+ static void *coalesce(void *bp)
+ {
+     /* get tags of next and previous blocks */
+ 	CHECK_HDR(HDRP(NEXT_BLKP(bp)));
+ 	if (!GET_PREV_ALLOC(HDRP(bp)))
+ 		CHECK_HDR(PSUB(bp, OVERHEAD));
+ 	size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+ 	size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
+
+ 	size_t size = GET_SIZE(HDRP(bp));
+
+
+     /* case 2 */
+ 	if (prev_alloc && !next_alloc)
+ 	{
+ 		size += GET_SIZE(HDRP(NEXT_BLKP(bp)));  /* add size of next free block */
+ 		rmv_from_free(NEXT_BLKP(bp));           /* remove the block from free list */
+ 		coalesce_count++;
+ 		PUT_HDR(HDRP(bp), PACK(size, 0));
+ 		PUT(FTRP(bp), PACK(size, 0));
+ 	}
+
+     /* case 3 */
+ 	else if (!prev_alloc && next_alloc)
+ 	{
+ 	  size += GET_SIZE(HDRP(PREV_BLKP(bp)));    /* add size of previous free block */
+ 	  UNTOUCH(bp);                               /* bp is now inside the previous block */
+ 	  bp = PREV_BLKP(bp);
+ 	  rmv_from_free(bp);                         /* remove the block from free list */
+ 	  coalesce_count++;
+ 	  PUT_HDR(HDRP(bp), PACK(size, 0));
+ 	  PUT(FTRP(bp), PACK(size, 0));
+ 	}
+
+     /* case 4 Coalesce with both*/
+ 	else if (!prev_alloc && !next_alloc)
+ 	{
+        /* add size of next and previous free block */
+ 		size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(HDRP(NEXT_BLKP(bp)));
+ 		rmv_from_free(PREV_BLKP(bp));   /* remove the block from free list */
+ 		rmv_from_free(NEXT_BLKP(bp));   /* remove the block from free list */
+ 		coalesce_count += 2;
+ 		UNTOUCH(bp);
+ 		bp = PREV_BLKP(bp);
+ 		PUT_HDR(HDRP(bp), PACK(size, 0));
+ 		PUT(FTRP(bp), PACK(size, 0));
+ 	}else if(prev_alloc && next_alloc){
+    // printf("Coalesce with nothing\n");
+  }
+
+    /* if case 1 occurs, it will drop down here without merging with any blocks */
+ 	CLR_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+ 	insert_front(bp);
+ 	return bp;
+}
+/*
+ * size_class -- returns the index of the free list that holds blocks of size bytes
+ * Precondition: size < SMALL_LIMIT
+ */
+static int size_class(size_t size)
+{
+    /* one class per 16 bytes, starting at the 32 byte minimum block */
+    return (size - MIN_BLOCK) / DSIZE;
+}
+
+/*
+ * insert_front -- insert free block at front of the free list for its size class,
+ * or into the tree if it is a large block
+ */
+static void insert_front(void *bp)
+{
+    TOUCH(bp);
+    if (GET_SIZE(HDRP(bp)) >= SMALL_LIMIT) {
+        tree_insert(bp);
+        return;
+    }
+
+    int class = size_class(GET_SIZE(HDRP(bp)));
+    void **headp = &seg_lists[class];
+
+    class_map |= 1UL << class;
+
+    if(*headp == NULL){
+
+        //Inserting into empty free list
+        PUT_LINK(bp, NULL);
+        PUT_LINK(PADD(bp, LSIZE), NULL);
+        *headp = bp;
+    }else{
+
+        //Inserting into free list with something
+        PUT_LINK(bp, NULL);
+        PUT_LINK(PADD(bp, LSIZE), *headp);
+        PUT_LINK(*headp, bp);
+        *headp = bp;
+    }
+	return;
+}
+/*
+ * rmv_from_free -- removes free block from the free list for its size class,
+ * or from the tree if it is a large block
+ * Precondition: the header of bp still holds the size it was inserted with
+ */
+static void rmv_from_free(void *bp)
+{
+    /* a block that stays one is touched again when it is placed or reinserted */
+    UNTOUCH(bp);
+    if (GET_SIZE(HDRP(bp)) >= SMALL_LIMIT) {
+        tree_remove(bp);
+        return;
+    }
+
+    int class = size_class(GET_SIZE(HDRP(bp)));
+    void **headp = &seg_lists[class];
+
+    //the block being removed is in middle of a list of blocks
+    if (PREV_FREE_BLKP(bp) != NULL && NEXT_FREE_BLKP(bp) != NULL){
+        PUT_LINK(NEXT_FREE_BLKP(bp), PREV_FREE_BLKP(bp));
+        PUT_LINK(PADD(PREV_FREE_BLKP(bp), LSIZE), NEXT_FREE_BLKP(bp));
+
+    //the block being removed is the first one in the free list
+    }else if (PREV_FREE_BLKP(bp) == NULL && NEXT_FREE_BLKP(bp) != NULL){
+        PUT_LINK(NEXT_FREE_BLKP(bp), NULL);
+        *headp = NEXT_FREE_BLKP(bp);
+
+    //the block being removed is the last one in the free list
+    }else if(PREV_FREE_BLKP(bp) != NULL && NEXT_FREE_BLKP(bp) == NULL){
+        PUT_LINK(PADD(PREV_FREE_BLKP(bp), LSIZE), NULL);
+
+    //the block being removed is the only one in the free list
+    }else{
+        *headp = NULL;
+        class_map &= ~(1UL << class);
+    }
+    return;
+}
+
+/*
+ * find_fit - Find a fit for a block with asize bytes
+ * Every block on a list has exactly its class's size, so a small request
+ * takes the head of its own class or, via class_map, of the next non-empty
+ * class without a scan. Failing that, and for large requests, the tree
+ * gives the best fit.
+ */
+static void *find_fit(size_t asize)
+{
+    int class;
+    unsigned long larger;
+
+    if (asize < SMALL_LIMIT) {
+        /* take the first block of the request's class or the next non-empty one */
+        class = size_class(asize);
+        larger = class_map & (~0UL << class);
+        if (larger != 0)
+            return seg_lists[__builtin_ctzl(larger)];
+    }
+
+    return tree_best_fit(asize);
+}
+
+/*
+ * tree_less -- Returns true if free block a comes before b in the tree,
+ * ordering by size and then by address
+ */
+static bool tree_less(void *a, void *b)
+{
+    size_t asize = GET_SIZE(HDRP(a));
+    size_t bsize = GET_SIZE(HDRP(b));
+
+    return asize < bsize || (asize == bsize && (char *)a < (char *)b);
+}
+
+/*
+ * tree_prio -- Returns the treap priority of a block, a hash of its address
+ */
+static size_t tree_prio(void *bp)
+{
+    return mix(HEAP_OFF(bp));
+}
+
+/*
+ * tree_replace -- Makes new the child of parent that old used to be
+ * (or the root, if parent is NULL)
+ */
+static void tree_replace(void *parent, void *old, void *new)
+{
+    if (parent == NULL)
+        tree_root = new;
+    else if (TREE_LEFT(parent) == old)
+        SET_LEFT(parent, new);
+    else
+        SET_RIGHT(parent, new);
+    if (new != NULL)
+        SET_PARENT(new, parent);
+}
+
+/*
+ * tree_rotate_up -- Rotates bp above its parent, keeping the tree ordered
+ */
+static void tree_rotate_up(void *bp)
+{
+    void *parent = TREE_PARENT(bp);
+    void *grandparent = TREE_PARENT(parent);
+
+    if (TREE_LEFT(parent) == bp) {
+        SET_LEFT(parent, TREE_RIGHT(bp));
+        if (TREE_RIGHT(bp) != NULL)
+            SET_PARENT(TREE_RIGHT(bp), parent);
+        SET_RIGHT(bp, parent);
+    } else {
+        SET_RIGHT(parent, TREE_LEFT(bp));
+        if (TREE_LEFT(bp) != NULL)
+            SET_PARENT(TREE_LEFT(bp), parent);
+        SET_LEFT(bp, parent);
+    }
+    SET_PARENT(parent, bp);
+    tree_replace(grandparent, parent, bp);
+}
+
+/*
+ * tree_insert -- Adds a large free block to the tree
+ */
+static void tree_insert(void *bp)
+{
+    void *parent = NULL;
+    void *next = tree_root;
+
+    /* ordinary BST insert as a leaf... */
+    while (next != NULL) {
+        parent = next;
+        next = tree_less(bp, parent) ? TREE_LEFT(parent) : TREE_RIGHT(parent);
+    }
+    SET_LEFT(bp, NULL);
+    SET_RIGHT(bp, NULL);
+    SET_PARENT(bp, parent);
+    if (parent == NULL)
+        tree_root = bp;
+    else if (tree_less(bp, parent))
+        SET_LEFT(parent, bp);
+    else
+        SET_RIGHT(parent, bp);
+
+    /* ...then rotate it up until the heap order on priorities holds again */
+    while (TREE_PARENT(bp) != NULL && tree_prio(bp) > tree_prio(TREE_PARENT(bp)))
+        tree_rotate_up(bp);
+}
+
+/*
+ * tree_remove -- Takes a large free block out of the tree
+ */
+static void tree_remove(void *bp)
+{
+    void *left, *right;
+
+    /* rotate bp down below its higher priority child until it has at most one child */
+    while ((left = TREE_LEFT(bp)) != NULL && (right = TREE_RIGHT(bp)) != NULL)
+        tree_rotate_up(tree_prio(left) > tree_prio(right) ? left : right);
+
+    /* then splice it out */
+    tree_replace(TREE_PARENT(bp), bp, TREE_LEFT(bp) != NULL ? TREE_LEFT(bp) : TREE_RIGHT(bp));
+}
+
+/*
+ * tree_best_fit -- Returns the smallest (and then lowest) free block in the
+ * tree with at least asize bytes, or NULL if there is none
+ */
+static void *tree_best_fit(size_t asize)
+{
+    void *bp = tree_root;
+    void *fit = NULL;
+
+    while (bp != NULL) {
+        if (GET_SIZE(HDRP(bp)) >= asize) {
+            fit = bp;
+            bp = TREE_LEFT(bp);
+        } else {
+            bp = TREE_RIGHT(bp);
+        }
+    }
+    return fit;
+}
+
+/*
+ * extend_heap - Extend heap with free block and return its block pointer
+ */
+static void *extend_heap(size_t words) {
+    char *bp;
+    size_t size;
+
+    /* Allocate an even number of words to maintain alignment */
+    size = words * WSIZE;
+    if (words % 2 == 1)
+        size += WSIZE;
+    // printf("extending heap to %zu bytes\n", mem_heapsize());
+    if ((long)(bp = mem_sbrk(size)) < 0)
+        return NULL;
+
+    /* Initialize free block header/footer and the epilogue header */
+    PUT_HDR(HDRP(bp), PACK(size, 0));     /* free block header, keeps old epilogue's prev-alloc bit */
+    PUT(FTRP(bp), PACK(size, 0));         /* free block footer */
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* new epilogue header */
+
+    /* Coalesce if the previous block was free */
+    return coalesce(bp);
+}
+
+/*
+ * trim_heap -- Shrinks the heap when the free block bp ends it and is
+ * bigger than TRIM_THRESHOLD, leaving a free tail of CHUNKSIZE bytes
+ */
+static void trim_heap(void *bp) {
+    size_t size = GET_SIZE(HDRP(bp));
+
+    if (size < TRIM_THRESHOLD || GET_SIZE(HDRP(NEXT_BLKP(bp))) != 0)
+        return;
+
+    rmv_from_free(bp);
+    if ((long)mem_sbrk(-(int)(size - CHUNKSIZE)) < 0) {
+        insert_front(bp);
+        return;
+    }
+    PUT_HDR(HDRP(bp), PACK(CHUNKSIZE, 0));
+    PUT(FTRP(bp), PACK(CHUNKSIZE, 0));
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* new epilogue header */
+    insert_front(bp);
+}
+
+/*
+ * check_heap -- Performs basic heap consistency checks for an implicit free list allocator
+ * and prints out all blocks in the heap in memory order.
+ * Checks include proper prologue and epilogue, alignment, matching header and footer
+ * for free blocks, no two free blocks in a row, and prev-alloc bits that agree with
+ * the previous block. Counts the free blocks into nfree.
+ * Takes a line number (to give the output an identifying tag).
+ */
+static bool check_heap(int line, size_t *nfree) {
+    char *bp;
+    size_t prev_alloc = 1;   /* the prologue is allocated */
+
+    *nfree = 0;
+
+    if ((GET_SIZE(HDRP(heap_start)) != DSIZE) || !GET_ALLOC(HDRP(heap_start))) {
+        printf("(check_heap at line %d) Error: bad prologue header\n", line);
+        return false;
+    }
+
+    for (bp = NEXT_BLKP(heap_start); GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+        if (!check_block(line, bp)) {
+            return false;
+        }
+        if (!GET_PREV_ALLOC(HDRP(bp)) != !prev_alloc) {
+            printf("(check_heap at line %d) Error: %p has a wrong prev-alloc bit\n", line, bp);
+            return false;
+        }
+        if (!prev_alloc && !GET_ALLOC(HDRP(bp))) {
+            printf("(check_heap at line %d) Error: %p and the block before it are both free\n", line, bp);
+            return false;
+        }
+        prev_alloc = GET_ALLOC(HDRP(bp));
+        if (!prev_alloc)
+            (*nfree)++;
+    }
+
+    if (!GET_PREV_ALLOC(HDRP(bp)) != !prev_alloc) {
+        printf("(check_heap at line %d) Error: epilogue has a wrong prev-alloc bit\n", line);
+        return false;
+    }
+    if ((GET_SIZE(HDRP(bp)) != 0) || !(GET_ALLOC(HDRP(bp)))) {
+        printf("(check_heap at line %d) Error: bad epilogue header\n", line);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * check_block -- Checks a block for alignment and, if it is free, matching header and footer
+ */
+static bool check_block(int line, void *bp) {
+    if ((size_t)bp % DSIZE) {
+        printf("(check_heap at line %d) Error: %p is not double-word aligned\n", line, bp);
+        return false;
+    }
+    if (!HDR_OK(HDRP(bp)) || (!GET_ALLOC(HDRP(bp)) && !HDR_OK(FTRP(bp)))) {
+        printf("(check_heap at line %d) Error: %p has a bad checksum\n", line, bp);
+        return false;
+    }
+    if (!GET_ALLOC(HDRP(bp)) && GET(HDRP(bp)) != (GET(FTRP(bp)) | GET_PREV_ALLOC(HDRP(bp)))) {
+        printf("(check_heap at line %d) Error: header does not match footer\n", line);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * check_touched -- Checks block bp, touched since the last check, and
+ * its boundaries with the blocks on either side, without walking the heap
+ */
+static bool check_touched(int line, void *bp) {
+    char *next;
+
+    if (!IN_HEAP(bp)) {
+        printf("(check_heap at line %d) Error: touched block %p is outside the heap\n", line, bp);
+        return false;
+    }
+    if (!check_block(line, bp))
+        return false;
+    next = NEXT_BLKP(bp);
+    if (GET_SIZE(HDRP(bp)) < MIN_BLOCK || GET_SIZE(HDRP(bp)) % DSIZE != 0
+        || next > (char *)mem_heap_hi() + 1) {
+        printf("(check_heap at line %d) Error: %p has a bad size\n", line, bp);
+        return false;
+    }
+    if (!GET_PREV_ALLOC(HDRP(next)) != !GET_ALLOC(HDRP(bp))) {
+        printf("(check_heap at line %d) Error: %p has a wrong prev-alloc bit\n", line, next);
+        return false;
+    }
+    if (!GET_PREV_ALLOC(HDRP(bp)) && GET_ALLOC(HDRP(PREV_BLKP(bp)))) {
+        printf("(check_heap at line %d) Error: %p has a wrong prev-alloc bit\n", line, bp);
+        return false;
+    }
+    if (!GET_ALLOC(HDRP(bp)))
+        return check_free_block(line, bp);
+    return true;
+}
+
+/*
+ * check_free_block -- Checks that the free block bp has allocated blocks on
+ * both sides and that the links of its free list or tree lead back to it
+ */
+static bool check_free_block(int line, void *bp) {
+    size_t size = GET_SIZE(HDRP(bp));
+    void *parent, *prev, *next;
+    int class;
+
+    if (!GET_PREV_ALLOC(HDRP(bp)) || !GET_ALLOC(HDRP(NEXT_BLKP(bp)))) {
+        printf("(check_heap at line %d) Error: free block %p has a free neighbour\n", line, bp);
+        return false;
+    }
+
+    if (size >= SMALL_LIMIT) {
+        parent = TREE_PARENT(bp);
+        if (parent == NULL ? tree_root != bp
+            : !IN_HEAP(parent) || (TREE_LEFT(parent) != bp && TREE_RIGHT(parent) != bp)) {
+            printf("(check_heap at line %d) Error: %p is not in the tree\n", line, bp);
+            return false;
+        }
+        if ((TREE_LEFT(bp) != NULL && (!IN_HEAP(TREE_LEFT(bp)) || TREE_PARENT(TREE_LEFT(bp)) != bp))
+            || (TREE_RIGHT(bp) != NULL && (!IN_HEAP(TREE_RIGHT(bp)) || TREE_PARENT(TREE_RIGHT(bp)) != bp))) {
+            printf("(check_heap at line %d) Error: the tree links below %p are broken\n", line, bp);
+            return false;
+        }
+        return true;
+    }
+
+    class = size_class(size);
+    prev = PREV_FREE_BLKP(bp);
+    next = NEXT_FREE_BLKP(bp);
+    if (prev == NULL ? seg_lists[class] != bp : !IN_HEAP(prev) || NEXT_FREE_BLKP(prev) != bp) {
+        printf("(check_heap at line %d) Error: %p is not in free list %d\n", line, bp, class);
+        return false;
+    }
+    if (next != NULL && (!IN_HEAP(next) || PREV_FREE_BLKP(next) != bp)) {
+        printf("(check_heap at line %d) Error: free list %d is broken after %p\n", line, class, bp);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * check_free_lists -- Checks every block on the segregated lists, in the
+ * tree and on the quick lists, taking time in proportion to their length
+ * rather than to the heap. Counts the free blocks into nfree.
+ */
+static bool check_free_lists(int line, size_t *nfree) {
+    size_t limit = mem_heapsize() / MIN_BLOCK;   /* more blocks than that means a cycle */
+    size_t count;
+    char *bp;
+    int class;
+
+    *nfree = 0;
+    for (class = 0; class < NUM_CLASSES; class++) {
+        if (!(class_map & (1UL << class)) != (seg_lists[class] == NULL)) {
+            printf("(check_heap at line %d) Error: class_map is wrong for free list %d\n", line, class);
+            return false;
+        }
+        for (bp = seg_lists[class]; bp != NULL; bp = NEXT_FREE_BLKP(bp)) {
+            if (!IN_HEAP(bp) || !check_block(line, bp)) {
+                printf("(check_heap at line %d) Error: free list %d has a bad link %p\n", line, class, bp);
+                return false;
+            }
+            if (GET_ALLOC(HDRP(bp)) || GET_SIZE(HDRP(bp)) >= SMALL_LIMIT
+                || size_class(GET_SIZE(HDRP(bp))) != class) {
+                printf("(check_heap at line %d) Error: %p does not belong in free list %d\n", line, bp, class);
+                return false;
+            }
+            if (!check_free_block(line, bp))
+                return false;
+            if (++*nfree > limit) {
+                printf("(check_heap at line %d) Error: free list %d has a cycle\n", line, class);
+                return false;
+            }
+        }
+    }
+
+    if (!check_tree(line, tree_root, NULL, NULL, NULL, nfree))
+        return false;
+
+    for (class = 0; class < NUM_CLASSES; class++) {
+        count = 0;
+        for (bp = quick_lists[class]; bp != NULL; bp = STACK_NEXT(bp)) {
+            if (!IN_HEAP(bp) || !GET_ALLOC(HDRP(bp)) || size_class(GET_SIZE(HDRP(bp))) != class) {
+                printf("(check_heap at line %d) Error: %p does not belong in quick list %d\n", line, bp, class);
+                return false;
+            }
+            if (++count > QUICK_LIMIT) {
+                printf("(check_heap at line %d) Error: quick list %d is too long\n", line, class);
+                return false;
+            }
+        }
+        if (count != (size_t)quick_counts[class]) {
+            printf("(check_heap at line %d) Error: quick list %d holds %zu blocks, not %d\n",
+                   line, class, count, quick_counts[class]);
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * check_tree -- Checks the subtree at bp, whose parent is parent, and
+ * every block in which must come after lo and before hi (NULL for no
+ * bound). Counts its blocks into nfree.
+ */
+static bool check_tree(int line, void *bp, void *parent, void *lo, void *hi, size_t *nfree) {
+    if (bp == NULL)
+        return true;
+    if (!IN_HEAP(bp) || !check_block(line, bp) || TREE_PARENT(bp) != parent) {
+        printf("(check_heap at line %d) Error: the tree has a bad link %p\n", line, bp);
+        return false;
+    }
+    if (GET_ALLOC(HDRP(bp)) || GET_SIZE(HDRP(bp)) < SMALL_LIMIT) {
+        printf("(check_heap at line %d) Error: %p does not belong in the tree\n", line, bp);
+        return false;
+    }
+    if ((lo != NULL && !tree_less(lo, bp)) || (hi != NULL && !tree_less(bp, hi))
+        || (parent != NULL && tree_prio(bp) > tree_prio(parent))) {
+        printf("(check_heap at line %d) Error: the tree is out of order at %p\n", line, bp);
+        return false;
+    }
+    if (!check_free_block(line, bp))
+        return false;
+    (*nfree)++;
+    return check_tree(line, TREE_LEFT(bp), bp, lo, bp, nfree)
+        && check_tree(line, TREE_RIGHT(bp), bp, bp, hi, nfree);
+}
+
+/*
+ * touch -- Adds block bp to the blocks touched since the last check, or
+ * with add false drops it because it has become part of another block
+ * Precondition: caller holds heap_lock
+ */
+static void touch(void *bp, bool add) {
+    size_t i;
+
+    for (i = mix((size_t)bp) & (TOUCH_SLOTS - 1); touched[i] != NULL; i = (i + 1) & (TOUCH_SLOTS - 1)) {
+        if (touched[i] == bp) {
+            if (!add)
+                touched[i] = TOUCH_GONE;
+            return;
+        }
+    }
+    if (!add)
+        return;
+    if (touch_count >= TOUCH_MAX) {
+        touch_overflow = true;
+        return;
+    }
+    touched[i] = bp;
+    touch_slots[touch_count++] = i;
+}
+
+/*
+ * touch_reset -- Forgets every touched block, after a check
+ */
+static void touch_reset(void) {
+    int i;
+
+    for (i = 0; i < touch_count; i++)
+        touched[touch_slots[i]] = NULL;
+    touch_count = 0;
+    touch_overflow = false;
+}
+
+/*
+ * print_heap -- Prints out the current state of the implicit free list
+ */
+static void print_heap() {
+    char *bp;
+
+    printf("Heap (%p):\n", heap_start);
+
+    for (bp = heap_start; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+        print_block(bp);
+    }
+
+    print_block(bp);
+}
+
+/*
+ * print_free_heap -- Prints out the current state of every segregated free list
+ * and the large block tree
+ */
+static void print_free_heap() {
+    char *bp;
+    int class;
+
+    for (class = 0; class < NUM_CLASSES; class++) {
+        if (seg_lists[class] == NULL)
+            continue;
+        printf("Class %d (%p):\n", class, seg_lists[class]);
+
+        for (bp = seg_lists[class]; bp != NULL; bp = NEXT_FREE_BLKP(bp)) {
+            print_block(bp);
+        }
+    }
+
+    for (class = 0; class < NUM_CLASSES; class++) {
+        if (quick_lists[class] == NULL)
+            continue;
+        printf("Quick list %d (%d blocks):\n", class, quick_counts[class]);
+
+        for (bp = quick_lists[class]; bp != NULL; bp = STACK_NEXT(bp)) {
+            print_block(bp);
+        }
+    }
+
+    printf("Tree (%p):\n", tree_root);
+    print_tree(tree_root);
+}
+
+/*
+ * print_tree -- Prints the blocks of a subtree of the large block tree in order
+ */
+static void print_tree(void *bp) {
+    if (bp == NULL)
+        return;
+    print_tree(TREE_LEFT(bp));
+    print_block(bp);
+    print_tree(TREE_RIGHT(bp));
+}
+
+/*
+ * print_block -- Prints out the current state of a block
+ */
+static void print_block(void *bp) {
+    size_t hsize, halloc, fsize, falloc;
+
+    hsize = GET_SIZE(HDRP(bp));
+    halloc = GET_ALLOC(HDRP(bp));
 
     if (hsize == 0) {
         printf("%p: End of free list\n", bp);
         return;
     }
 
+    /* allocated blocks have no footer */
+    if (halloc) {
+        printf("%p: header: [%ld:a:%c]\n", bp,
+           hsize, (GET_PREV_ALLOC(HDRP(bp)) ? 'a' : 'f'));
+        return;
+    }
+    fsize = GET_SIZE(FTRP(bp));
+    falloc = GET_ALLOC(FTRP(bp));
+
     printf("%p: header: [%ld:%c] footer: [%ld:%c]\n", bp,
        hsize, (halloc ? 'a' : 'f'),
        fsize, (falloc ? 'a' : 'f'));
@@ -561,3 +2601,84 @@ static void print_block(void *bp) {
 static size_t max(size_t x, size_t y) {
     return (x > y) ? x : y;
 }
+
+/*
+ * min: returns x if x < y, and y otherwise.
+ */
+static size_t min(size_t x, size_t y) {
+    return (x < y) ? x : y;
+}
+
+/*
+ * mix: returns a hash of x with its bits mixed well (MurmurHash3's
+ * finalizer), since block addresses and offsets are very regular
+ */
+static size_t mix(size_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdUL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53UL;
+    x ^= x >> 33;
+    return x;
+}
+
+/*
+ * cmp_ptr: qsort comparison function that orders pointers by address
+ */
+static int cmp_ptr(const void *a, const void *b) {
+    char *x = *(char * const *)a;
+    char *y = *(char * const *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * cmp_stack: qsort comparison function that orders indexes of prof_stacks
+ * by live bytes, most first
+ */
+static int cmp_stack(const void *a, const void *b) {
+    size_t x = prof_stacks[*(const int *)a].live_bytes;
+    size_t y = prof_stacks[*(const int *)b].live_bytes;
+
+    return (x < y) - (x > y);
+}
+
+#ifdef HARDENED
+/*
+ * mm_corrupt: reports that the heap is corrupt at p and aborts
+ */
+void mm_corrupt(void *p, const char *what) {
+    fprintf(stderr, "mm: %s at %p\n", what, p);
+    abort();
+}
+
+/*
+ * put_word: writes the header or footer word val at p with its checksum,
+ * the top bits of (p ^ val) times the (odd) secret
+ */
+static inline void put_word(void *p, word_t val) {
+    val &= ~CSUM_MASK;
+    *(word_t *)p = val | ((((size_t)p ^ val) * (mm_link_secret | 1)) & CSUM_MASK);
+}
+
+/*
+ * word_ok: returns whether the checksum of the word at p is right
+ */
+static inline bool word_ok(void *p) {
+    word_t val = *(word_t *)p & ~CSUM_MASK;
+
+    return (*(word_t *)p & CSUM_MASK) == ((((size_t)p ^ val) * (mm_link_secret | 1)) & CSUM_MASK);
+}
+
+/*
+ * reveal: decodes a free block link, which must be NULL or point into
+ * the heap's reserved range
+ */
+static inline void *reveal(void *link) {
+    void *p = HIDE(link);
+
+    if (p != NULL && (HEAP_OFF(p) >= MAX_HEAP || (size_t)p % DSIZE != 0))
+        mm_corrupt(link, "bad free list link");
+    return p;
+}
+#endif
@@ -1,10 +1,158 @@
 #include <stdio.h>
 
 extern int mm_init (void);
-extern void *mm_malloc (size_t size);
+extern void *mm_malloc_slow (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
 
+/*
+ * Lifetime hints for mm_malloc_hint. They also name the regions of the
+ * heap that mm_region and mm_region_size report on.
+ */
+#define MM_HINT_NONE   0   /* no idea, or expected to live long */
+#define MM_HINT_SHORT  1   /* expected to be freed soon */
+
+extern void *mm_malloc_hint(size_t size, int hint);
+extern int mm_region(void *ptr);
+extern size_t mm_region_size(int region);
+
+/*
+ * A snapshot of the heap from mm_stats. Free means coalesced and on the
+ * free lists; blocks waiting on a quick list or in a thread cache do not
+ * count. free_hist[k] counts the free blocks of MM_STATS_MIN << k bytes up
+ * to twice that, and the last bucket also every bigger one.
+ */
+#define MM_STATS_MIN      16
+#define MM_STATS_BUCKETS  20
+
+typedef struct {
+    size_t heap_size;        /* bytes from the heap start to the brk */
+    size_t mapped_bytes;     /* bytes in blocks with a mapping of their own */
+    size_t peak_size;        /* largest heap_size + mapped_bytes so far */
+    size_t free_bytes;       /* bytes in free blocks */
+    size_t free_blocks;      /* number of free blocks */
+    size_t largest_free;     /* size of the largest free block */
+    size_t quick_bytes;      /* bytes freed but waiting on a quick list */
+    double fragmentation;    /* 1 - largest_free / free_bytes, 0 with nothing free */
+    size_t free_hist[MM_STATS_BUCKETS];
+    unsigned long splits;    /* blocks split in two since mm_init */
+    unsigned long coalesces; /* pairs of neighbouring blocks merged since mm_init */
+} mm_stats_t;
+
+extern void mm_stats(mm_stats_t *stats);
+
+/*
+ * Levels of mm_checkheap, from cheapest to most thorough. Each returns
+ * nonzero if the heap is consistent and prints what is wrong otherwise.
+ */
+#define MM_CHECK_OFF      0   /* check nothing */
+#define MM_CHECK_TOUCHED  1   /* blocks allocated, freed or resized since the last check */
+#define MM_CHECK_FREE     2   /* every free list, the tree and the quick lists */
+#define MM_CHECK_FULL     3   /* every block in the heap, and the free structures */
+
+extern int mm_checkheap(int level);
+
+extern void *mm_calloc(size_t nmemb, size_t size);
+extern void *mm_memalign(size_t alignment, size_t size);
+extern void *mm_aligned_alloc(size_t alignment, size_t size);
+
+extern size_t mm_malloc_batch(size_t size, size_t n, void **out);
+extern void mm_free_batch(void **ptrs, size_t n);
+
+/*
+ * Sampling heap profiler. After mm_prof_start(interval), mm_malloc takes a
+ * sample about once every interval bytes: it records the block and the
+ * call stack that asked for it until the block is freed or reallocated.
+ * mm_prof_dump writes the live samples grouped by call stack, biggest
+ * first. A sample of size bytes stands for max(size, interval) bytes, so
+ * the totals are estimates of all the live bytes, sampled or not:
+ *   heap profile: <bytes> live bytes in <n> samples, <m> stacks, interval <i>
+ *   <bytes> live bytes in <n> samples (<bytes> bytes in <n> since the start):
+ *   <one line per frame, as backtrace_symbols_fd writes them>
+ * mm_prof_start(0) stops sampling; mm_init forgets every sample.
+ */
+extern void mm_prof_start(size_t interval);
+extern void mm_prof_dump(FILE *fp);
+extern void *mm_malloc_sample(size_t size);
+
+/*
+ * The per-thread cache that mm_malloc tries before anything else, see
+ * mm.c. It lives here so that mm_malloc can be inlined into its callers.
+ */
+#define MM_TCACHE_BINS 16    /* bins in a thread cache */
+#define MM_FAST_MAX    240   /* largest request mm_malloc serves inline */
+#ifdef COMPACT
+#define MM_FAST_SHIFT  2     /* mm_size_bins has one entry per header size */
+#else
+#define MM_FAST_SHIFT  3
+#endif
+
+typedef struct {
+    void *bins[MM_TCACHE_BINS];   /* stacks linked through the first payload word */
+    int counts[MM_TCACHE_BINS];   /* number of blocks in each stack */
+    int fills[MM_TCACHE_BINS];    /* blocks to fetch on the next refill */
+    unsigned long epoch;          /* value of mm_heap_epoch the bins belong to */
+    long prof_left;               /* bytes to allocate before the next profiler sample */
+} mm_tcache_t;
+
+extern __thread mm_tcache_t mm_tcache;
+extern unsigned long mm_heap_epoch;
+/* bin for a request of size bytes, at index ceil(size / 2^MM_FAST_SHIFT) */
+extern const unsigned char mm_size_bins[];
+
+/*
+ * Built with -DHARDENED, the links between cached blocks are stored XORed
+ * with mm_link_secret, drawn anew by every mm_init, and a cached block
+ * holds a key in its second word so that freeing it again is caught at
+ * once, see mm.c. mm_corrupt reports what it found and aborts.
+ */
+#ifdef HARDENED
+extern size_t mm_link_secret;
+extern void mm_corrupt(void *bp, const char *what) __attribute__((noreturn));
+
+/* the block after bp on a thread cache or quick list stack */
+static inline void *mm_stack_next(void *bp)
+{
+    void *next = (void *)((size_t)*(void **)bp ^ mm_link_secret);
+
+    if ((size_t)next % 16 != 0)
+        mm_corrupt(bp, "bad free list link");
+    return next;
+}
+#define MM_STACK_NEXT(bp)  mm_stack_next(bp)
+#define MM_UNMARK(bp)      (((void **)(bp))[1] = NULL)
+#else
+#define MM_STACK_NEXT(bp)  (*(void **)(bp))
+#define MM_UNMARK(bp)
+#endif
+
+/*
+ * mm_malloc - Allocate a block. A request the thread cache can serve is
+ *     popped off its bin right here, the rest goes to mm_malloc_slow.
+ *     The profiler costs only the countdown, see mm_prof_start.
+ */
+static inline void *mm_malloc(size_t size)
+{
+    mm_tcache_t *tc = &mm_tcache;
+    void *bp;
+    int bin;
+
+    if ((tc->prof_left -= (long)size) < 0)
+        return mm_malloc_sample(size);
+
+    /* size - 1 wraps around for size 0, which the slow path rejects */
+    if (size - 1 < MM_FAST_MAX && tc->epoch == mm_heap_epoch) {
+        bin = mm_size_bins[(size + (1 << MM_FAST_SHIFT) - 1) >> MM_FAST_SHIFT];
+        if ((bp = tc->bins[bin]) != NULL) {
+            tc->bins[bin] = MM_STACK_NEXT(bp);
+            tc->counts[bin]--;
+            MM_UNMARK(bp);
+            return bp;
+        }
+    }
+    return mm_malloc_slow(size);
+}
+
 
 /* 
  * You can work in teams of one or two. Enter your team name, 
@@ -0,0 +1,371 @@
+/*
+ * repgen.c - Writes a synthetic trace for mdriver, in the .rep format,
+ * to stdout.
+ *
+ * The trace allocates -n blocks. Their sizes and lifetimes are drawn
+ * from the -s and -l distributions, a lifetime being the number of
+ * allocations the block outlives. A block may grow by realloc during
+ * its life (-r). With -q the blocks are freed in the order they were
+ * allocated instead, once more than a given number are live, as a
+ * consumer draining a producer's queue would. The live payload is kept
+ * under -m bytes, by freeing the blocks due soonest early, so that the
+ * trace fits the simulated heap. Every block is freed by the end.
+ *
+ * A distribution is written kind:params, one of
+ *     uniform:lo:hi        any value from lo to hi
+ *     power:alpha:lo:hi    from lo to hi, with density falling as x^-alpha
+ *     bimodal:a:b:p        near a with probability p, else near b
+ *     exp:mean             exponential with that mean
+ *
+ * For example, sizes mostly small with a long tail, short lives, and
+ * one block in ten doubling in size three times:
+ *
+ *     repgen -n 20000 -s power:1.5:8:65536 -l exp:200 -r 0.1:2:3 > traces/gen-bal.rep
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+#include "config.h"
+
+#define MAXDIST 64              /* longest distribution argument */
+
+/* A distribution of sizes or lifetimes */
+typedef struct {
+    enum {UNIFORM, POWER, BIMODAL, EXP} kind;
+    double a, b, c;             /* its parameters, in the order written */
+} dist_t;
+
+/* An op of the trace being built */
+typedef struct {
+    char type;                  /* 'a', 'r' or 'f' */
+    int id;
+    int size;
+} op_t;
+
+/* A free or a realloc due at some point of the trace */
+typedef struct {
+    long when;                  /* number of allocations made before it */
+    int id;
+    int size;                   /* new size of a realloc, 0 for a free */
+} event_t;
+
+/* Global variables */
+static unsigned long seed = 1;  /* state of the random number generator (-S) */
+static op_t *ops = NULL;        /* the trace so far */
+static long num_ops = 0;
+static long max_ops = 0;
+static event_t *events = NULL;  /* min-heap on when */
+static long num_events = 0;
+static long max_events = 0;
+static int *sizes = NULL;       /* current size of each live block, 0 once freed */
+static long live_bytes = 0;
+static long peak_bytes = 0;     /* most live_bytes so far, for the header */
+
+/* Function prototypes */
+static double uniform(void);
+static int parse_dist(char *arg, dist_t *dist);
+static double draw(dist_t *dist);
+static void emit(char type, int id, int size);
+static void push_event(long when, int id, int size);
+static event_t pop_event(void);
+static void usage(void);
+
+int main(int argc, char **argv)
+{
+    dist_t size_dist = {UNIFORM, 16, 4096, 0};
+    dist_t life_dist = {EXP, 100, 0, 0};
+    int num_blocks = 10000;     /* blocks to allocate (-n) */
+    double grow_frac = 0;       /* fraction of blocks that grow (-r)... */
+    double grow_factor = 2;     /* ...by this factor... */
+    int grow_steps = 0;         /* ...this many times */
+    int queue = 0;              /* if > 0, free FIFO beyond this many live blocks (-q) */
+    long max_live = MAX_HEAP / 5 * 3; /* cap on the live payload (-m) */
+    int head = 0;               /* oldest block not yet freed, with -q */
+    int i, k, size, life;
+    double x;
+    long when;
+    event_t e;
+    char c;
+
+    while ((c = getopt(argc, argv, "n:s:l:r:q:m:S:h")) != -1) {
+        switch (c) {
+        case 'n': /* Number of blocks */
+            num_blocks = atoi(optarg);
+            break;
+        case 's': /* Distribution of block sizes */
+            if (!parse_dist(optarg, &size_dist)) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'l': /* Distribution of block lifetimes */
+            if (!parse_dist(optarg, &life_dist)) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'r': /* Realloc growth: fraction:factor:steps */
+            if (sscanf(optarg, "%lf:%lf:%d", &grow_frac, &grow_factor, &grow_steps) != 3) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'q': /* Producer-consumer frees */
+            queue = atoi(optarg);
+            break;
+        case 'm': /* Most payload bytes live at once */
+            max_live = atol(optarg);
+            break;
+        case 'S': /* Seed */
+            seed = strtoul(optarg, NULL, 0) | 1;
+            break;
+        case 'h': /* Print this message */
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (num_blocks < 1 || max_live < 1) {
+        usage();
+        exit(1);
+    }
+    /* sizes in a trace are ints */
+    if (max_live > INT_MAX)
+        max_live = INT_MAX;
+    if ((sizes = (int *)calloc(num_blocks, sizeof(int))) == NULL) {
+        fprintf(stderr, "repgen: out of memory\n");
+        exit(1);
+    }
+
+    for (i = 0; i < num_blocks; i++) {
+        /* Carry out whatever falls due before this allocation */
+        while (num_events > 0 && events[0].when <= i) {
+            e = pop_event();
+            if (sizes[e.id] == 0 || live_bytes + e.size - sizes[e.id] > max_live)
+                continue;
+            emit(e.size ? 'r' : 'f', e.id, e.size);
+        }
+
+        /* clamp before converting, a draw may not fit in an int */
+        x = draw(&size_dist);
+        size = !(x >= 1) ? 1 : (x > max_live) ? (int)max_live : (int)x;
+
+        /* Make room under the cap, freeing the blocks due soonest */
+        while (live_bytes + size > max_live) {
+            if (queue > 0) {
+                while (sizes[head] == 0)
+                    head++;
+                emit('f', head, 0);
+                continue;
+            }
+            e = pop_event();
+            if (sizes[e.id] != 0 && e.size == 0)
+                emit('f', e.id, 0);
+        }
+
+        emit('a', i, size);
+
+        if (queue > 0) {
+            /* The consumer frees the oldest block once the queue is full */
+            while (sizes[head] == 0)
+                head++;
+            if (i + 1 - head > queue)
+                emit('f', head, 0);
+            continue;
+        }
+
+        /* Schedule its free, and the reallocs that grow it before that */
+        x = draw(&life_dist);
+        life = !(x >= 0) ? 0 : (x > INT_MAX) ? INT_MAX : (int)x;
+        when = (long)i + 1 + life;
+        push_event(when, i, 0);
+        if (grow_steps > 0 && uniform() < grow_frac) {
+            for (k = 1; k <= grow_steps; k++) {
+                x = size * grow_factor;
+                if (!(x >= 1) || x > max_live / 4)
+                    break;
+                size = (int)x;
+                push_event(i + 1 + (long)life * k / (grow_steps + 1), i, size);
+            }
+        }
+    }
+
+    /* Free what is left, in the order it falls due */
+    while (num_events > 0) {
+        e = pop_event();
+        if (sizes[e.id] != 0 && e.size == 0)
+            emit('f', e.id, 0);
+    }
+    for (i = head; i < num_blocks; i++)
+        if (sizes[i] != 0)
+            emit('f', i, 0);
+
+    printf("%ld\n%d\n%ld\n%d\n", peak_bytes, num_blocks, num_ops, 1);
+    for (i = 0; i < num_ops; i++) {
+        if (ops[i].type == 'f')
+            printf("f %d\n", ops[i].id);
+        else
+            printf("%c %d %d\n", ops[i].type, ops[i].id, ops[i].size);
+    }
+    return 0;
+}
+
+/*
+ * uniform - a random number in [0, 1), from a xorshift generator
+ */
+static double uniform(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return (seed >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * parse_dist - read a distribution written as described at the top of
+ *     this file. Returns 0 if arg is not one.
+ */
+static int parse_dist(char *arg, dist_t *dist)
+{
+    char kind[MAXDIST];
+    int n;
+
+    if (sscanf(arg, "%63[a-z]:%n", kind, &n) != 1)
+        return 0;
+    arg += n;
+    if (!strcmp(kind, "uniform")) {
+        dist->kind = UNIFORM;
+        return sscanf(arg, "%lf:%lf", &dist->a, &dist->b) == 2 && dist->a <= dist->b;
+    }
+    if (!strcmp(kind, "power")) {
+        dist->kind = POWER;
+        return sscanf(arg, "%lf:%lf:%lf", &dist->a, &dist->b, &dist->c) == 3 &&
+            dist->b > 0 && dist->b <= dist->c;
+    }
+    if (!strcmp(kind, "bimodal")) {
+        dist->kind = BIMODAL;
+        return sscanf(arg, "%lf:%lf:%lf", &dist->a, &dist->b, &dist->c) == 3;
+    }
+    if (!strcmp(kind, "exp")) {
+        dist->kind = EXP;
+        return sscanf(arg, "%lf", &dist->a) == 1;
+    }
+    return 0;
+}
+
+/*
+ * draw - a random value from dist
+ */
+static double draw(dist_t *dist)
+{
+    double u = uniform(), lo, hi, e;
+
+    switch (dist->kind) {
+    case UNIFORM:
+        return dist->a + u * (dist->b - dist->a + 1);
+    case POWER:
+        /* invert the distribution function of x^-alpha on [lo, hi] */
+        lo = dist->b;
+        hi = dist->c + 1;
+        if (fabs(dist->a - 1) < 1e-9)
+            return lo * pow(hi / lo, u);
+        e = 1 - dist->a;
+        return pow(pow(lo, e) + u * (pow(hi, e) - pow(lo, e)), 1 / e);
+    case BIMODAL:
+        /* within a quarter either way of the mode */
+        lo = (u < dist->c) ? dist->a : dist->b;
+        return lo * (0.75 + 0.5 * uniform());
+    case EXP:
+        return -dist->a * log(1 - u);
+    }
+    return 0;
+}
+
+/*
+ * emit - add an op to the trace, keeping track of the live blocks
+ */
+static void emit(char type, int id, int size)
+{
+    if (num_ops == max_ops) {
+        max_ops = max_ops ? 2 * max_ops : 1024;
+        if ((ops = (op_t *)realloc(ops, max_ops * sizeof(op_t))) == NULL) {
+            fprintf(stderr, "repgen: out of memory\n");
+            exit(1);
+        }
+    }
+    ops[num_ops].type = type;
+    ops[num_ops].id = id;
+    ops[num_ops].size = size;
+    num_ops++;
+
+    live_bytes += size - sizes[id];
+    sizes[id] = size;
+    peak_bytes = (live_bytes > peak_bytes) ? live_bytes : peak_bytes;
+}
+
+/*
+ * push_event - schedule a free (size 0) or a realloc of block id
+ */
+static void push_event(long when, int id, int size)
+{
+    long i;
+    event_t e = {when, id, size};
+
+    if (num_events == max_events) {
+        max_events = max_events ? 2 * max_events : 1024;
+        if ((events = (event_t *)realloc(events, max_events * sizeof(event_t))) == NULL) {
+            fprintf(stderr, "repgen: out of memory\n");
+            exit(1);
+        }
+    }
+    for (i = num_events++; i > 0 && events[(i - 1) / 2].when > when; i = (i - 1) / 2)
+        events[i] = events[(i - 1) / 2];
+    events[i] = e;
+}
+
+/*
+ * pop_event - remove and return the event due soonest
+ */
+static event_t pop_event(void)
+{
+    event_t top = events[0];
+    event_t last = events[--num_events];
+    long i = 0, child;
+
+    while ((child = 2 * i + 1) < num_events) {
+        if (child + 1 < num_events && events[child + 1].when < events[child].when)
+            child++;
+        if (events[child].when >= last.when)
+            break;
+        events[i] = events[child];
+        i = child;
+    }
+    events[i] = last;
+    return top;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: repgen [-h] [-n <blocks>] [-s <dist>] [-l <dist>] [-r <frac>:<factor>:<steps>]\n");
+    fprintf(stderr, "              [-q <depth>] [-m <bytes>] [-S <seed>] > <file>.rep\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-l <dist>  Lifetimes, in allocations (default exp:100).\n");
+    fprintf(stderr, "\t-m <bytes> Most payload live at once (default 3/5 of MAX_HEAP).\n");
+    fprintf(stderr, "\t-n <n>     Allocate n blocks (default 10000).\n");
+    fprintf(stderr, "\t-q <depth> Free oldest first, once more than depth blocks are live.\n");
+    fprintf(stderr, "\t-r <f>:<x>:<k> Grow a fraction f of the blocks k times by x, by realloc.\n");
+    fprintf(stderr, "\t-s <dist>  Payload sizes (default uniform:16:4096).\n");
+    fprintf(stderr, "\t-S <seed>  Seed the random numbers (default 1).\n");
+    fprintf(stderr, "<dist> is uniform:<lo>:<hi>, power:<alpha>:<lo>:<hi>,\n");
+    fprintf(stderr, "bimodal:<a>:<b>:<p> or exp:<mean>.\n");
+}